@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+
+#include "harness.hpp"
+#include "verifier.hpp"
+
+CodeBlock *Block::finish()
+{
+	delete code;
+	code = new CodeBlock(program.cells.size(), &program.cells[0]);
+	verify_procedure(code);
+	return code;
+}
+
+double Result::min() const
+{
+	return *std::min_element(samples.begin(), samples.end());
+}
+
+double Result::median() const
+{
+	std::vector<double> sorted(samples);
+	std::sort(sorted.begin(), sorted.end());
+	unsigned int middle = sorted.size() / 2;
+	if (sorted.size() % 2 == 1) return sorted[middle];
+	return (sorted[middle - 1] + sorted[middle]) / 2.0;
+}
+
+double Result::mean() const
+{
+	double total = 0.0;
+	for (unsigned int i=0; i<samples.size(); ++i) total += samples[i];
+	return total / samples.size();
+}
+
+Suite::Suite(const std::string &f, unsigned int r, double s)
+: filter(f), repeat(r > 0 ? r : 1), scale(s), failed(false) {}
+
+int Suite::scaled(int n) const
+{
+	double value = std::floor(n * scale);
+	if (value < 1.0) return 1;
+	if (value > 2147483647.0) return 2147483647;
+	return static_cast<int>(value);
+}
+
+bool Suite::selected(const std::string &name) const
+{
+	return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+const Result *Suite::measure(const std::string &name, unsigned long long operations, const std::function<Cell()> &sample)
+{
+	if (!selected(name)) return NULL;
+
+	Result result;
+	result.name = name;
+	result.operations = operations > 0 ? operations : 1;
+	for (unsigned int i=0; i<repeat; ++i)
+	{
+		Cell value;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		value = sample();
+		std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+		double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+		result.samples.push_back(ns / result.operations);
+		result.value = value.toString();
+	}
+	results.push_back(result);
+
+	std::cout << std::left << std::setw(36) << name
+		<< " " << std::right << std::setw(12) << std::fixed << std::setprecision(2) << result.median() << " ns/op"
+		<< "  min " << std::setw(12) << result.min()
+		<< "  n=" << result.operations
+		<< "  result=" << result.value << std::endl;
+	return &results.back();
+}
+
+void Suite::fail(const std::string &name, const std::string &reason)
+{
+	failed = true;
+	std::cerr << name << " FAILED: " << reason << std::endl;
+}
+
+static std::string json_string(const std::string &s)
+{
+	std::ostringstream output;
+	output << '"';
+	for (unsigned int i=0; i<s.size(); ++i)
+	{
+		unsigned char c = static_cast<unsigned char>(s[i]);
+		if (c == '"' || c == '\\') output << '\\' << s[i];
+		else if (c == '\n') output << "\\n";
+		else if (c < 0x20) output << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<unsigned int>(c) << std::dec << std::setfill(' ');
+		else output << s[i];
+	}
+	output << '"';
+	return output.str();
+}
+
+#ifndef OOPART_BUILD_TYPE
+#define OOPART_BUILD_TYPE ""
+#endif
+#ifndef OOPART_BUILD_LTO
+#define OOPART_BUILD_LTO 0
+#endif
+#ifndef OOPART_BUILD_PGO
+#define OOPART_BUILD_PGO ""
+#endif
+
+void Suite::write_json(std::ostream &output) const
+{
+	output << std::setprecision(3) << std::fixed;
+	output << "{\n";
+	output << "  \"schema\": 1,\n";
+	output << "  \"build\": {\n";
+	output << "    \"type\": " << json_string(OOPART_BUILD_TYPE) << ",\n";
+	#ifdef OOPART_JIT
+	output << "    \"jit\": true,\n";
+	#else
+	output << "    \"jit\": false,\n";
+	#endif
+	output << "    \"lto\": " << (OOPART_BUILD_LTO ? "true" : "false") << ",\n";
+	output << "    \"pgo\": " << json_string(OOPART_BUILD_PGO) << ",\n";
+	#ifdef __VERSION__
+	output << "    \"compiler\": " << json_string(__VERSION__) << "\n";
+	#else
+	output << "    \"compiler\": \"\"\n";
+	#endif
+	output << "  },\n";
+	output << "  \"repeat\": " << repeat << ",\n";
+	output << "  \"scale\": " << scale << ",\n";
+	output << "  \"ok\": " << (failed ? "false" : "true") << ",\n";
+	output << "  \"benchmarks\": [";
+	for (unsigned int i=0; i<results.size(); ++i)
+	{
+		const Result &r = results[i];
+		output << (i > 0 ? ",\n" : "\n");
+		output << "    {\"name\": " << json_string(r.name)
+			<< ", \"unit\": \"ns/op\""
+			<< ", \"operations\": " << r.operations
+			<< ", \"median\": " << r.median()
+			<< ", \"min\": " << r.min()
+			<< ", \"mean\": " << r.mean()
+			<< ", \"samples\": [";
+		for (unsigned int s=0; s<r.samples.size(); ++s)
+		{
+			if (s > 0) output << ", ";
+			output << r.samples[s];
+		}
+		output << "], \"result\": " << json_string(r.value) << "}";
+	}
+	output << "\n  ]\n}\n";
+}
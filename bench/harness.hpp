@@ -0,0 +1,116 @@
+#ifndef bench_harness_hpp
+#define bench_harness_hpp
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <deque>
+
+#include "interpreter.hpp"
+#include "instructions.hpp"
+
+/*
+	Shared pieces of the bench target: a bytecode assembler for building
+	workloads, and a Suite that times them and reports the results as text
+	and as JSON for comparing builds.
+*/
+
+struct Program
+{
+	std::vector<Cell> cells;
+
+	unsigned int here() const { return cells.size(); }
+	void emit(Cell c) { cells.push_back(c); }
+	void emit_immediate(Cell value)
+	{
+		emit(Cell(load_immediate));
+		emit(value);
+	}
+
+	/* emits a jump instruction and returns the index of its offset cell */
+	unsigned int emit_jump(Instruction inst)
+	{
+		emit(Cell(inst));
+		emit(Cell(0));
+		return here() - 1;
+	}
+
+	/* offsets are relative to the cell following the offset operand */
+	void patch(unsigned int offset_cell, unsigned int target)
+	{
+		cells[offset_cell] = Cell(static_cast<int>(target) - static_cast<int>(offset_cell + 1));
+	}
+
+	/* for (i := n; i != 0; --i) body, leaving the stack as the body found it */
+	template <typename Body> void emit_counted_loop(int n, Body body)
+	{
+		emit_immediate(Cell(n));
+		unsigned int loop = here();
+		emit(Cell(duplicate));
+		unsigned int exit_jump = emit_jump(jump_if_zero);
+		body(*this);
+		emit_immediate(Cell(1));
+		emit(Cell(subtract_int32));
+		patch(emit_jump(jump_relative), loop);
+		patch(exit_jump, here());
+		emit(Cell(drop));
+	}
+};
+
+/* a Program's cells viewed as a CodeBlock; the cells must outlive it */
+struct Block
+{
+	Program program;
+	CodeBlock *code;
+
+	Block() : code(NULL) {}
+	~Block() { delete code; }
+	/* call once the program is complete; verifies it as compile_procedure would */
+	CodeBlock *finish();
+};
+
+struct Result
+{
+	std::string name;
+	unsigned long long operations;		// per sample
+	std::vector<double> samples;		// nanoseconds per operation
+	std::string value;			// what the workload computed, for spotting broken builds
+
+	double min() const;
+	double median() const;
+	double mean() const;
+};
+
+class Suite
+{
+	std::deque<Result> results;		// measure hands out pointers into it
+	std::string filter;
+	unsigned int repeat;
+	double scale;
+	bool failed;
+
+	public:
+	Suite(const std::string &filter, unsigned int repeat, double scale);
+
+	/* iteration counts are multiplied by --scale, never below 1 */
+	int scaled(int n) const;
+
+	bool selected(const std::string &name) const;
+
+	/* times sample() repeat times; it performs operations units of work and returns its result */
+	const Result *measure(const std::string &name, unsigned long long operations, const std::function<Cell()> &sample);
+
+	/* records a correctness failure, which makes bench exit non-zero */
+	void fail(const std::string &name, const std::string &reason);
+	bool ok() const { return !failed; }
+
+	void write_json(std::ostream &output) const;
+};
+
+void loop_benchmarks(Suite &suite);
+void micro_benchmarks(Suite &suite);
+void macro_benchmarks(Suite &suite);
+
+#endif
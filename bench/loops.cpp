@@ -0,0 +1,140 @@
+#include "harness.hpp"
+#include "verifier.hpp"
+
+/*
+	Loop-heavy integer kernels for the native arithmetic and branch instructions.
+	Each kernel is assembled into a single CodeBlock and run to exit_program.
+*/
+
+/* i := n; while (i != 0) i := i - 1 */
+static void build_count_down(Program &p, int n)
+{
+	p.emit_immediate(n);
+	unsigned int loop = p.here();
+	p.emit(Cell(duplicate));
+	unsigned int exit_jump = p.emit_jump(jump_if_zero);
+	p.emit_immediate(1);
+	p.emit(Cell(subtract_int32));
+	p.patch(p.emit_jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(Cell(exit_program));
+}
+
+/* acc := 0; for i := n downto 1: acc := (acc + i) mod 1000003 */
+static void build_modular_sum(Program &p, int n)
+{
+	p.emit_immediate(0);
+	p.emit_immediate(n);
+	unsigned int loop = p.here();
+	p.emit(Cell(duplicate));
+	unsigned int exit_jump = p.emit_jump(jump_if_zero);
+	p.emit(Cell(swap));
+	p.emit(Cell(over));
+	p.emit(Cell(add_int32));
+	p.emit_immediate(1000003);
+	p.emit(Cell(modulo_int32));
+	p.emit(Cell(swap));
+	p.emit_immediate(1);
+	p.emit(Cell(subtract_int32));
+	p.patch(p.emit_jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(Cell(drop));
+	p.emit(Cell(exit_program));
+}
+
+/* count i in [0, n) with (i * 7) mod 13 < 6, exercising compare and both branch kinds */
+static void build_branchy_count(Program &p, int n)
+{
+	p.emit_immediate(0);
+	p.emit_immediate(n);
+	unsigned int loop = p.here();
+	p.emit(Cell(duplicate));
+	unsigned int exit_jump = p.emit_jump(jump_if_zero);
+	p.emit_immediate(1);
+	p.emit(Cell(subtract_int32));
+	p.emit(Cell(duplicate));
+	p.emit_immediate(7);
+	p.emit(Cell(multiply_int32));
+	p.emit_immediate(13);
+	p.emit(Cell(modulo_int32));
+	p.emit_immediate(6);
+	p.emit(Cell(less_int32));
+	p.patch(p.emit_jump(jump_if_zero), loop);
+	p.emit(Cell(swap));
+	p.emit_immediate(1);
+	p.emit(Cell(add_int32));
+	p.emit(Cell(swap));
+	p.patch(p.emit_jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(Cell(drop));
+	p.emit(Cell(exit_program));
+}
+
+/* acc := 0.0; for i := n downto 1: acc := acc + 1.0 / i, mixing int32 counters with unboxed doubles */
+static void build_harmonic_sum(Program &p, int n)
+{
+	p.emit_immediate(n);
+	p.emit(Cell(load_immediate));
+	p.emit(Cell(0.0));
+	unsigned int loop = p.here();
+	p.emit(Cell(over));
+	unsigned int exit_jump = p.emit_jump(jump_if_zero);
+	p.emit(Cell(over));
+	p.emit(Cell(convert_to_float64));
+	p.emit(Cell(load_immediate));
+	p.emit(Cell(1.0));
+	p.emit(Cell(swap));
+	p.emit(Cell(divide_float64));
+	p.emit(Cell(add_float64));
+	p.emit(Cell(swap));
+	p.emit_immediate(1);
+	p.emit(Cell(subtract_int32));
+	p.emit(Cell(swap));
+	p.patch(p.emit_jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(Cell(swap));
+	p.emit(Cell(drop));
+	p.emit(Cell(exit_program));
+}
+
+static Cell run_once(const CodeBlock *block, bool jit)
+{
+	RuntimeMachine machine;
+	machine.set_jit_enabled(jit);
+	return machine.execute(block);
+}
+
+/* runs a kernel checked, verified and with the JIT, and checks all three agree */
+static void run(Suite &suite, const char *name, void (*build)(Program&, int), int n)
+{
+	std::string prefix = std::string("loops/") + name;
+	if (!suite.selected(prefix)) return;
+
+	Program p;
+	build(p, suite.scaled(n));
+	CodeBlock block(p.cells.size(), &p.cells[0]);
+	unsigned long long operations = suite.scaled(n);
+
+	const Result *checked = suite.measure(prefix + "/checked", operations, [&]() { return run_once(&block, false); });
+	if (!verify_procedure(&block))
+	{
+		suite.fail(prefix, "failed verification");
+		return;
+	}
+	const Result *verified = suite.measure(prefix + "/verified", operations, [&]() { return run_once(&block, false); });
+	const Result *compiled = suite.measure(prefix + "/jit", operations, [&]() { return run_once(&block, true); });
+
+	std::string expected = checked ? checked->value : run_once(&block, false).toString();
+	if ((verified && verified->value != expected) || (compiled && compiled->value != expected))
+	{
+		suite.fail(prefix, "modes disagree, interpreter computed " + expected);
+	}
+}
+
+void loop_benchmarks(Suite &suite)
+{
+	run(suite, "count_down", build_count_down, 200000);
+	run(suite, "modular_sum", build_modular_sum, 200000);
+	run(suite, "branchy_count", build_branchy_count, 200000);
+	run(suite, "harmonic_sum", build_harmonic_sum, 200000);
+}
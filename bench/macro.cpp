@@ -0,0 +1,372 @@
+#include "harness.hpp"
+#include "verifier.hpp"
+#include "io.hpp"
+
+#include <cstring>
+#include <unistd.h>
+
+/*
+	Macro workloads: small programs that mix calls, allocation and strings the
+	way scripts do. Each reports time per unit of work named in its comment.
+*/
+
+static char key_next[] = "next";
+static char key_value[] = "value";
+static char phrase[] = "the quick brown fox jumps over";
+static char empty[] = "";
+static char loopback[] = "127.0.0.1";
+static char word_inc[] = "inc";
+
+/* fib(n) = n < 2 ? n : fib(n - 1) + fib(n - 2); reported per call */
+static void recursive_fib(Suite &suite, int n)
+{
+	std::ostringstream name;
+	name << "macro/fib/" << n;
+	if (!suite.selected(name.str())) return;
+
+	Program body;
+	CodeBlock fib(0, NULL);
+	body.emit(Cell(duplicate));
+	body.emit_immediate(Cell(2));
+	body.emit(Cell(less_int32));
+	unsigned int recurse = body.emit_jump(jump_if_zero);
+	body.emit(Cell(return_from_function));
+	body.patch(recurse, body.here());
+	body.emit(Cell(duplicate));
+	body.emit_immediate(Cell(1));
+	body.emit(Cell(subtract_int32));
+	body.emit(Cell(&fib));
+	body.emit(Cell(swap));
+	body.emit_immediate(Cell(2));
+	body.emit(Cell(subtract_int32));
+	body.emit(Cell(&fib));
+	body.emit(Cell(add_int32));
+	body.emit(Cell(return_from_function));
+	fib.size = body.cells.size();
+	fib.text = &body.cells[0];
+	verify_procedure(&fib);
+
+	Block block;
+	block.program.emit_immediate(Cell(n));
+	block.program.emit(Cell(&fib));
+	block.program.emit(Cell(exit_program));
+	CodeBlock *code = block.finish();
+
+	/* calls made: c(n) = 1 + c(n - 1) + c(n - 2) */
+	unsigned long long calls[2] = { 1, 1 };
+	for (int i=2; i<=n; ++i)
+	{
+		unsigned long long next = 1 + calls[0] + calls[1];
+		calls[0] = calls[1];
+		calls[1] = next;
+	}
+
+	RuntimeMachine machine;
+	const Result *result = suite.measure(name.str(), calls[1], [&]() {
+		machine.reset();
+		return machine.execute(code);
+	});
+
+	long long a = 0, b = 1;
+	for (int i=0; i<n; ++i)
+	{
+		long long next = a + b;
+		a = b;
+		b = next;
+	}
+	std::ostringstream expected;
+	expected << "$" << a;
+	if (result && result->value != expected.str()) suite.fail(name.str(), "expected " + expected.str());
+
+	fib.text = NULL;
+}
+
+/*
+	Rounds of short-lived pairs of linked objects next to a long-lived tree,
+	with a full collection after each round; reported per pair.
+*/
+static void object_graph_churn(Suite &suite)
+{
+	const char *name = "macro/object_graph_churn";
+	if (!suite.selected(name)) return;
+
+	int pairs = suite.scaled(5000);
+	const int rounds = 8;
+
+	Block block;
+	block.program.emit_counted_loop(pairs, [](Program &p) {
+		p.emit(Cell(create_empty_object));
+		p.emit(Cell(create_empty_object));
+		p.emit_immediate(Cell(key_next));
+		p.emit(Cell(swap));
+		p.emit(Cell(set_object_attribute));
+		p.emit_immediate(Cell(42));
+		p.emit(Cell(swap));
+		p.emit_immediate(Cell(key_value));
+		p.emit(Cell(swap));
+		p.emit(Cell(set_object_attribute));
+		p.emit(Cell(drop));
+	});
+	block.program.emit(Cell(exit_program));
+	CodeBlock *code = block.finish();
+
+	RuntimeMachine machine;
+	Object *tree = machine.create_object();
+	for (int i=0; i<255; ++i)
+	{
+		Object *child = machine.create_object();
+		child->setattr(Cell(key_value), Cell(i));
+		tree->setattr(Cell(i), Cell(child));
+	}
+
+	suite.measure(name, static_cast<unsigned long long>(pairs) * rounds, [&]() {
+		for (int r=0; r<rounds; ++r)
+		{
+			machine.reset();
+			machine.push_argument(Cell(tree));
+			machine.execute(code);
+			machine.collect_garbage();
+		}
+		return Cell(static_cast<long long>(machine.heap_size()));
+	});
+}
+
+/*
+	Per iteration: build a string from a literal, concatenate, hash, slice and
+	search it, and append a piece to an accumulator; reported per iteration.
+*/
+static void string_heavy(Suite &suite)
+{
+	const char *name = "macro/string_heavy";
+	if (!suite.selected(name)) return;
+
+	int n = suite.scaled(20000);
+	RuntimeMachine machine;
+	String *suffix = machine.create_managed_string(" the lazy dog", 13);
+	String *needle = machine.create_managed_string("fox", 3);
+	String *piece = machine.create_managed_string("ab", 2);
+
+	Block block;
+	Program &p = block.program;
+	p.emit_immediate(Cell(empty));
+	p.emit(Cell(make_string));
+	p.emit_counted_loop(n, [&](Program &p) {
+		p.emit_immediate(Cell(phrase));
+		p.emit(Cell(make_string));
+		p.emit_immediate(Cell(suffix));
+		p.emit(Cell(string_concatenate));
+		p.emit(Cell(duplicate));
+		p.emit(Cell(string_hash));
+		p.emit(Cell(drop));
+		p.emit_immediate(Cell(3));
+		p.emit(Cell(swap));
+		p.emit_immediate(Cell(20));
+		p.emit(Cell(swap));
+		p.emit(Cell(string_slice));
+		p.emit_immediate(Cell(needle));
+		p.emit(Cell(string_find));
+		p.emit(Cell(drop));
+
+		/* the loop counter sits above the accumulator */
+		p.emit(Cell(swap));
+		p.emit_immediate(Cell(piece));
+		p.emit(Cell(string_concatenate));
+		p.emit(Cell(swap));
+	});
+	p.emit(Cell(string_length));
+	p.emit(Cell(exit_program));
+	CodeBlock *code = block.finish();
+
+	const Result *result = suite.measure(name, n, [&]() {
+		machine.reset();
+		return machine.execute(code);
+	});
+
+	std::ostringstream expected;
+	expected << "$" << 2 * n;
+	if (result && result->value != expected.str()) suite.fail(name, "expected " + expected.str());
+}
+
+/*
+	Startup of a program that defines many procedures, each calling a word
+	several times, and then calls only the last one; reported per procedure
+	defined. Bodies are resolved when first called, so this should stay
+	close to the cost of skipping over them.
+*/
+static void define_many(Suite &suite)
+{
+	const char *name = "macro/define_many";
+	if (!suite.selected(name)) return;
+
+	int procedures = suite.scaled(2000);
+	const int calls = 16;
+
+	RuntimeMachine machine;
+	CodeBlock *inc = machine.create_anonymous_procedure(4);
+	inc->text[0] = Cell(load_immediate);
+	inc->text[1] = Cell(1);
+	inc->text[2] = Cell(add_int32);
+	inc->text[3] = Cell(return_from_function);
+	machine.define_word(word_inc, inc);
+
+	Block block;
+	Program &p = block.program;
+	for (int i=0; i<procedures; ++i)
+	{
+		if (i > 0) p.emit(Cell(drop));
+		p.emit(Cell(compile_procedure));
+		p.emit(Cell(calls + 1));
+		for (int c=0; c<calls; ++c) p.emit(Cell(word_inc));
+		p.emit(Cell(return_from_function));
+	}
+	p.emit_immediate(Cell(0));
+	p.emit(Cell(swap));
+	p.emit(Cell(execute_stack_procedure));
+	p.emit(Cell(exit_program));
+	CodeBlock *code = block.finish();
+
+	const Result *result = suite.measure(name, procedures, [&]() {
+		machine.reset();
+		return machine.execute(code);
+	});
+
+	std::ostringstream expected;
+	expected << "$" << calls;
+	if (result && result->value != expected.str()) suite.fail(name, "expected " + expected.str());
+}
+
+struct EchoTotals
+{
+	int finished;
+	int failed;
+	int bytes;
+};
+
+static void echo_finished(RuntimeMachine *machine, std::exception_ptr error, void *data)
+{
+	EchoTotals *totals = static_cast<EchoTotals*>(data);
+	if (error || machine->status() != EXECUTION_FINISHED) ++totals->failed;
+	else
+	{
+		++totals->finished;
+		totals->bytes += machine->pop_argument().int32;
+	}
+}
+
+/*
+	Connections in flight at once on one EventLoop: each is a server machine
+	that accepts, reads a message and echoes it back, and a client machine
+	that connects, sends the message and reads the echo; reported per
+	connection.
+*/
+static void loopback_echo(Suite &suite, int connections)
+{
+	std::ostringstream name;
+	name << "macro/loopback_echo/" << connections;
+	if (!suite.selected(name.str())) return;
+
+	const int message = 64;
+	std::vector<RuntimeMachine*> servers, clients;
+	std::vector<Block*> blocks;
+	std::vector<int> listeners;
+
+	for (int i=0; i<connections; ++i)
+	{
+		RuntimeMachine *server = new RuntimeMachine;
+		servers.push_back(server);
+		Block listen;
+		listen.program.emit_immediate(Cell(loopback));
+		listen.program.emit_immediate(Cell(0));
+		listen.program.emit(Cell(io_listen));
+		listen.program.emit(Cell(duplicate));
+		listen.program.emit(Cell(io_local_port));
+		listen.program.emit(Cell(exit_program));
+		server->execute(listen.finish());
+		int port = server->pop_argument().int32;
+		int listener = server->pop_argument().int32;
+		listeners.push_back(listener);
+		server->reset();
+
+		Array *buffer = server->create_array(ELEMENT_BYTE, message);
+		Block *serve = new Block;
+		blocks.push_back(serve);
+		Program &s = serve->program;
+		s.emit_immediate(Cell(listener));
+		s.emit(Cell(io_accept));
+		s.emit(Cell(duplicate));
+		s.emit_immediate(Cell(buffer));
+		s.emit(Cell(swap));
+		s.emit(Cell(io_read));
+		s.emit(Cell(drop));
+		s.emit(Cell(duplicate));
+		s.emit_immediate(Cell(buffer));
+		s.emit(Cell(swap));
+		s.emit(Cell(io_write));
+		s.emit(Cell(swap));
+		s.emit(Cell(io_close));
+		s.emit(Cell(exit_program));
+		serve->finish();
+
+		RuntimeMachine *client = new RuntimeMachine;
+		clients.push_back(client);
+		Array *out = client->create_array(ELEMENT_BYTE, message);
+		memset(out->data, 'x', message);
+		Array *in = client->create_array(ELEMENT_BYTE, message);
+		Block *call = new Block;
+		blocks.push_back(call);
+		Program &c = call->program;
+		c.emit_immediate(Cell(loopback));
+		c.emit_immediate(Cell(port));
+		c.emit(Cell(io_connect));
+		c.emit(Cell(duplicate));
+		c.emit_immediate(Cell(out));
+		c.emit(Cell(swap));
+		c.emit(Cell(io_write));
+		c.emit(Cell(drop));
+		c.emit(Cell(duplicate));
+		c.emit_immediate(Cell(in));
+		c.emit(Cell(swap));
+		c.emit(Cell(io_read));
+		c.emit(Cell(swap));
+		c.emit(Cell(io_close));
+		c.emit(Cell(exit_program));
+		call->finish();
+	}
+
+	EventLoop loop;
+	EchoTotals totals;
+	loop.set_completion_callback(echo_finished, &totals);
+	const Result *result = suite.measure(name.str(), connections, [&]() {
+		totals.finished = 0;
+		totals.failed = 0;
+		totals.bytes = 0;
+		for (int i=0; i<connections; ++i)
+		{
+			servers[i]->reset();
+			loop.start(servers[i], blocks[2 * i]->code);
+			clients[i]->reset();
+			loop.start(clients[i], blocks[2 * i + 1]->code);
+		}
+		loop.run();
+		return Cell(totals.failed > 0 ? -1 : totals.bytes);
+	});
+
+	/* servers and clients each report the message length */
+	std::ostringstream expected;
+	expected << "$" << 2 * message * connections;
+	if (result && result->value != expected.str()) suite.fail(name.str(), "expected " + expected.str());
+
+	for (unsigned int i=0; i<listeners.size(); ++i) close(listeners[i]);
+	for (unsigned int i=0; i<blocks.size(); ++i) delete blocks[i];
+	for (unsigned int i=0; i<servers.size(); ++i) delete servers[i];
+	for (unsigned int i=0; i<clients.size(); ++i) delete clients[i];
+}
+
+void macro_benchmarks(Suite &suite)
+{
+	recursive_fib(suite, 20);
+	object_graph_churn(suite);
+	string_heavy(suite);
+	define_many(suite);
+	loopback_echo(suite, 256);
+}
@@ -0,0 +1,69 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdlib>
+
+#include "harness.hpp"
+
+/*
+	bench [--filter SUBSTRING] [--repeat N] [--scale FACTOR] [--json PATH]
+
+	Runs the loop kernels, the microbenchmarks and the macro workloads, prints
+	one line per benchmark, and with --json writes the results for comparing
+	builds ("-" writes them to stdout instead of the text report). Exits
+	non-zero if any workload computed the wrong answer.
+*/
+
+static void usage(const char *program)
+{
+	std::cerr << "usage: " << program << " [--filter SUBSTRING] [--repeat N] [--scale FACTOR] [--json PATH]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	std::string filter;
+	std::string json_path;
+	unsigned int repeat = 3;
+	double scale = 1.0;
+
+	for (int i=1; i<argc; ++i)
+	{
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--filter") == 0 && has_value) filter = argv[++i];
+		else if (strcmp(argv[i], "--repeat") == 0 && has_value) repeat = static_cast<unsigned int>(strtoul(argv[++i], NULL, 10));
+		else if (strcmp(argv[i], "--scale") == 0 && has_value) scale = strtod(argv[++i], NULL);
+		else if (strcmp(argv[i], "--json") == 0 && has_value) json_path = argv[++i];
+		else
+		{
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	/* with JSON on stdout the text report would corrupt it */
+	std::ofstream discard;
+	std::streambuf *report = std::cout.rdbuf();
+	if (json_path == "-") std::cout.rdbuf(discard.rdbuf());
+
+	Suite suite(filter, repeat, scale);
+	loop_benchmarks(suite);
+	micro_benchmarks(suite);
+	macro_benchmarks(suite);
+
+	std::cout.rdbuf(report);
+	if (json_path == "-")
+	{
+		suite.write_json(std::cout);
+	}
+	else if (!json_path.empty())
+	{
+		std::ofstream output(json_path.c_str());
+		suite.write_json(output);
+		if (!output)
+		{
+			std::cerr << "could not write " << json_path << std::endl;
+			return 2;
+		}
+	}
+	return suite.ok() ? 0 : 1;
+}
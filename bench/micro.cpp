@@ -0,0 +1,296 @@
+#include "harness.hpp"
+#include "embedding.hpp"
+
+/*
+	Microbenchmarks: each times one mechanism in a counted loop, so the
+	figures include the loop's own few instructions; micro/empty_loop is that
+	overhead on its own. Times are per iteration unless the name says otherwise.
+*/
+
+/* runs block on a machine kept across samples, so only execution is timed */
+static void measure_block(Suite &suite, const std::string &name, unsigned long long operations, Block &block)
+{
+	if (!suite.selected(name)) return;
+	CodeBlock *code = block.finish();
+	RuntimeMachine machine;
+	suite.measure(name, operations, [&]() {
+		machine.reset();
+		return machine.execute(code);
+	});
+}
+
+static void empty_loop(Suite &suite)
+{
+	int n = suite.scaled(200000);
+	Block block;
+	block.program.emit_counted_loop(n, [](Program &) {});
+	block.program.emit(Cell(exit_program));
+	measure_block(suite, "micro/empty_loop", n, block);
+}
+
+/* 8 load_immediate/drop pairs per iteration; reported per pair */
+static void push_pop(Suite &suite)
+{
+	int n = suite.scaled(50000);
+	Block block;
+	block.program.emit_counted_loop(n, [](Program &p) {
+		for (int i=0; i<8; ++i)
+		{
+			p.emit_immediate(Cell(i));
+			p.emit(Cell(drop));
+		}
+	});
+	block.program.emit(Cell(exit_program));
+	measure_block(suite, "micro/push_pop", 8ULL * n, block);
+}
+
+/* a generic instruction per step, so every one goes through the instruction table; reported per instruction */
+static void dispatch(Suite &suite)
+{
+	int n = suite.scaled(25000);
+	Block block;
+	block.program.emit_counted_loop(n, [](Program &p) {
+		for (int i=0; i<4; ++i)
+		{
+			p.emit_immediate(Cell(i));
+			p.emit(Cell(duplicate));
+			p.emit(Cell(add_number));
+			p.emit(Cell(drop));
+		}
+	});
+	block.program.emit(Cell(exit_program));
+	measure_block(suite, "micro/dispatch", 16ULL * n, block);
+}
+
+static void call_return(Suite &suite)
+{
+	int n = suite.scaled(100000);
+	Block callee;
+	callee.program.emit(Cell(return_from_function));
+	CodeBlock *target = callee.finish();
+
+	Block block;
+	block.program.emit_counted_loop(n, [&](Program &p) {
+		p.emit(Cell(target));
+	});
+	block.program.emit(Cell(exit_program));
+	measure_block(suite, "micro/call_return", n, block);
+}
+
+static void host_add(HostCall &call, void *)
+{
+	call.push(Cell(call.int32(0) + call.int32(1)));
+}
+
+/* a two-argument host function called through its word's procedure */
+static void host_call(Suite &suite)
+{
+	if (!suite.selected("micro/host_call")) return;
+
+	int n = suite.scaled(100000);
+	RuntimeMachine machine;
+	CodeBlock *add = machine.define_host_function("host_add", 2, host_add);
+
+	Block block;
+	block.program.emit_counted_loop(n, [&](Program &p) {
+		p.emit_immediate(Cell(20));
+		p.emit_immediate(Cell(22));
+		p.emit(Cell(add));
+		p.emit(Cell(drop));
+	});
+	block.program.emit(Cell(exit_program));
+	CodeBlock *code = block.finish();
+	suite.measure("micro/host_call", n, [&]() {
+		machine.reset();
+		return machine.execute(code);
+	});
+}
+
+/* objects with size attributes, looked up and replaced by the middle key */
+static void object_attributes(Suite &suite, int size)
+{
+	std::ostringstream suffix;
+	suffix << "/" << size;
+	std::string get_name = "micro/getattr" + suffix.str();
+	std::string set_name = "micro/setattr" + suffix.str();
+	if (!suite.selected(get_name) && !suite.selected(set_name)) return;
+
+	int n = suite.scaled(50000);
+	RuntimeMachine owner;
+	Object *object = owner.create_object();
+	for (int i=0; i<size; ++i) object->setattr(Cell(i), Cell(i * 2));
+	Cell key(size / 2);
+
+	Block get;
+	get.program.emit_counted_loop(n, [&](Program &p) {
+		p.emit_immediate(key);
+		p.emit_immediate(Cell(object));
+		p.emit(Cell(get_object_attribute));
+		p.emit(Cell(drop));
+	});
+	get.program.emit(Cell(exit_program));
+	measure_block(suite, get_name, n, get);
+
+	Block set;
+	set.program.emit_counted_loop(n, [&](Program &p) {
+		p.emit_immediate(Cell(7));
+		p.emit_immediate(key);
+		p.emit_immediate(Cell(object));
+		p.emit(Cell(set_object_attribute));
+		p.emit(Cell(drop));
+	});
+	set.program.emit(Cell(exit_program));
+	measure_block(suite, set_name, n, set);
+}
+
+static void allocation(Suite &suite)
+{
+	int n = suite.scaled(50000);
+	Block objects;
+	objects.program.emit_counted_loop(n, [](Program &p) {
+		p.emit(Cell(create_empty_object));
+		p.emit(Cell(drop));
+	});
+	objects.program.emit(Cell(exit_program));
+
+	/* a fresh machine per sample, so the heap does not grow across them */
+	if (suite.selected("micro/allocate_object"))
+	{
+		CodeBlock *code = objects.finish();
+		suite.measure("micro/allocate_object", n, [&]() {
+			RuntimeMachine machine;
+			return machine.execute(code);
+		});
+	}
+
+	Block arrays;
+	arrays.program.emit_counted_loop(n, [](Program &p) {
+		p.emit_immediate(Cell(16));
+		p.emit_immediate(Cell(static_cast<int>(ELEMENT_INT32)));
+		p.emit(Cell(create_array));
+		p.emit(Cell(drop));
+	});
+	arrays.program.emit(Cell(exit_program));
+
+	if (suite.selected("micro/allocate_array"))
+	{
+		CodeBlock *code = arrays.finish();
+		suite.measure("micro/allocate_array", n, [&]() {
+			RuntimeMachine machine;
+			return machine.execute(code);
+		});
+	}
+}
+
+/* a complete tree of objects with the given fanout, built from the host */
+static Object *build_tree(RuntimeMachine &machine, int nodes, int fanout)
+{
+	std::vector<Object*> all;
+	all.reserve(nodes);
+	all.push_back(machine.create_object());
+	for (int i=1; i<nodes; ++i)
+	{
+		Object *node = machine.create_object();
+		node->setattr(Cell(-1), Cell(i));
+		all[(i - 1) / fanout]->setattr(Cell((i - 1) % fanout), Cell(node));
+		all.push_back(node);
+	}
+	return all[0];
+}
+
+/* one full collection of a heap that is half live tree, half garbage; reported per collection */
+static void gc_pause(Suite &suite, int nodes)
+{
+	std::ostringstream name;
+	name << "micro/gc_pause/" << nodes;
+	if (!suite.selected(name.str())) return;
+
+	RuntimeMachine machine;
+	Object *root = build_tree(machine, nodes, 8);
+	suite.measure(name.str(), 1, [&]() {
+		machine.reset();
+		for (int i=0; i<nodes; ++i) machine.create_object();
+		machine.push_argument(Cell(root));
+		machine.collect_garbage();
+		return Cell(static_cast<long long>(machine.heap_size()));
+	});
+}
+
+/* chains of objects hanging off one root: parallelism comes only from the number of chains */
+static Object *build_chains(RuntimeMachine &machine, int nodes, int chains)
+{
+	Object *root = machine.create_object();
+	for (int c=0; c<chains; ++c)
+	{
+		Object *link = machine.create_object();
+		root->setattr(Cell(c), Cell(link));
+		for (int i=1; i<nodes / chains; ++i)
+		{
+			Object *next = machine.create_object();
+			link->setattr(Cell(0), Cell(next));
+			link = next;
+		}
+	}
+	return root;
+}
+
+/*
+	Pause of a full collection of an all-live heap as marker threads are
+	added, on a wide graph (a tree with fanout 64) and a deep one (64 long
+	chains); reported per collection. Every thread count must mark the same
+	number of cells.
+*/
+static void gc_threads(Suite &suite, const char *shape, int nodes)
+{
+	std::ostringstream prefix;
+	prefix << "micro/gc_threads/" << shape << "/";
+
+	RuntimeMachine machine;
+	bool built = false;
+	Object *root = NULL;
+	std::string expected;
+
+	unsigned int counts[] = { 1, 2, 4, 8 };
+	for (unsigned int i=0; i<sizeof(counts) / sizeof(counts[0]); ++i)
+	{
+		std::ostringstream name;
+		name << prefix.str() << counts[i];
+		if (!suite.selected(name.str())) continue;
+
+		if (!built)
+		{
+			root = std::string(shape) == "wide" ? build_tree(machine, nodes, 64) : build_chains(machine, nodes, 64);
+			built = true;
+		}
+		machine.set_gc_threads(counts[i]);
+		const Result *result = suite.measure(name.str(), 1, [&]() {
+			machine.reset();
+			machine.push_argument(Cell(root));
+			machine.collect_garbage();
+			return Cell(static_cast<long long>(machine.heap_statistics().last.marked));
+		});
+		if (!result) continue;
+		if (expected.empty()) expected = result->value;
+		else if (result->value != expected) suite.fail(name.str(), "marked " + result->value + ", expected " + expected);
+	}
+}
+
+void micro_benchmarks(Suite &suite)
+{
+	empty_loop(suite);
+	push_pop(suite);
+	dispatch(suite);
+	call_return(suite);
+	host_call(suite);
+
+	int sizes[] = { 1, 8, 64, 512 };
+	for (unsigned int i=0; i<sizeof(sizes) / sizeof(sizes[0]); ++i) object_attributes(suite, sizes[i]);
+
+	allocation(suite);
+
+	int heaps[] = { 1000, 4000, 16000 };
+	for (unsigned int i=0; i<sizeof(heaps) / sizeof(heaps[0]); ++i) gc_pause(suite, heaps[i]);
+
+	gc_threads(suite, "wide", suite.scaled(200000));
+	gc_threads(suite, "deep", suite.scaled(200000));
+}
@@ -0,0 +1,28 @@
+#ifndef bytecode_hpp
+#define bytecode_hpp
+
+#include <iosfwd>
+#include <string>
+#include <stdexcept>
+
+#include "interpreter.hpp"
+
+class BytecodeFormatError : public std::runtime_error
+{
+	public:
+	BytecodeFormatError(std::string msg);
+};
+
+// one instruction per line, with its offset and immediates
+std::string disassemble(const CodeBlock *block);
+
+/*
+	Bytecode images hold a procedure together with every procedure it refers
+	to, including their exception handler tables. Instructions are stored by opcode, so images stay loadable as long as
+	opcodes.def is only appended to. Objects, arrays and addresses have no
+	serialized form.
+*/
+void serialize_procedure(const CodeBlock *block, std::ostream &output);
+CodeBlock* deserialize_procedure(RuntimeMachine *meta, std::istream &input);
+
+#endif
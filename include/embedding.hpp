@@ -0,0 +1,70 @@
+#ifndef embedding_hpp
+#define embedding_hpp
+#include "interpreter.hpp"
+
+/*
+	Host functions: C++ callables registered as words with
+	RuntimeMachine::define_host_function, and called from bytecode like any
+	other word.
+
+	A call sees its arguments where bytecode left them on the operand stack,
+	first argument deepest, so nothing is copied or converted on the way in.
+	The arguments stay on the stack until the function returns, which keeps
+	them rooted if it collects garbage. Results are pushed above them and
+	slid down into their place afterwards. Anything the function allocates
+	should be pushed, or otherwise made reachable, before it can collect.
+
+	Throwing one of the VM's exceptions (CellTypeException, ArithmeticError,
+	...) raises a bytecode error at the call, which handlers can catch.
+*/
+class HostCall
+{
+	RuntimeMachine *meta;
+	unsigned int base;
+	unsigned int count;
+
+	public:
+	HostCall(RuntimeMachine *m, unsigned int b, unsigned int n) : meta(m), base(b), count(n) {}
+
+	unsigned int arity() const { return count; }
+	RuntimeMachine &machine() { return *meta; }
+
+	/*
+		Arguments are read and written by index rather than by reference:
+		push() and anything that runs bytecode may grow the operand stack and
+		move it, which would leave a reference dangling.
+	*/
+	Cell argument(unsigned int i) const
+	{
+		return meta->argument_stack[slot(i)];
+	}
+	void set_argument(unsigned int i, Cell value)
+	{
+		meta->argument_stack[slot(i)] = value;
+	}
+
+	int int32(unsigned int i) { return typed(i, INT32).int32; }
+	long long int64(unsigned int i) { return typed(i, INT64).int64; }
+	double float64(unsigned int i) { return typed(i, FLOAT64).float64; }
+	Object *object(unsigned int i) { return typed(i, OBJECT).object; }
+	Array *array(unsigned int i) { return typed(i, ARRAY).array; }
+	String *string(unsigned int i) { return typed(i, STRING).str; }
+
+	void push(Cell result) { meta->argument_stack.push_back(result); }
+
+	private:
+	unsigned int slot(unsigned int i) const
+	{
+		if (i >= count) throw ExecutionOutOfBoundsError("HostCall::argument - index past arity");
+		return base + i;
+	}
+
+	Cell typed(unsigned int i, CellType t) const
+	{
+		Cell c = argument(i);
+		if (c.type != t) throw CellTypeException(t, c.type, "host function argument");
+		return c;
+	}
+};
+
+#endif
@@ -6,6 +6,7 @@
 void load_immediate(RuntimeMachine *meta);
 
 // compile_word(size, instructions*, return) -- Procedure
+// words in the body are resolved on its first call, so the compiling block's cells must outlive it
 void compile_procedure(RuntimeMachine *meta);
 
 // create_empty_object -- Object
@@ -17,9 +18,244 @@ void set_object_attribute(RuntimeMachine *meta);
 // key object set_object_attribute -- object
 void get_object_attribute(RuntimeMachine *meta);
 
+// value duplicate -- value value
+void duplicate(RuntimeMachine *meta);
+
+// value drop --
+void drop(RuntimeMachine *meta);
+
+// a b swap -- b a
+void swap(RuntimeMachine *meta);
+
+// a b over -- a b a
+void over(RuntimeMachine *meta);
+
+/* integer arithmetic; overflow and division by zero raise ArithmeticError */
+
 // int int add_int32 -- int
 void add_int32(RuntimeMachine *meta);
 
+// lhs rhs subtract_int32 -- lhs-rhs
+void subtract_int32(RuntimeMachine *meta);
+
+// int int multiply_int32 -- int
+void multiply_int32(RuntimeMachine *meta);
+
+// lhs rhs divide_int32 -- lhs/rhs (truncated)
+void divide_int32(RuntimeMachine *meta);
+
+// lhs rhs modulo_int32 -- lhs%rhs (sign of lhs)
+void modulo_int32(RuntimeMachine *meta);
+
+// int negate_int32 -- -int
+void negate_int32(RuntimeMachine *meta);
+
+/* integer comparisons push $1 for true and $0 for false */
+
+// lhs rhs equal_int32 -- lhs==rhs
+void equal_int32(RuntimeMachine *meta);
+
+// lhs rhs not_equal_int32 -- lhs!=rhs
+void not_equal_int32(RuntimeMachine *meta);
+
+// lhs rhs less_int32 -- lhs<rhs
+void less_int32(RuntimeMachine *meta);
+
+// lhs rhs less_equal_int32 -- lhs<=rhs
+void less_equal_int32(RuntimeMachine *meta);
+
+// lhs rhs greater_int32 -- lhs>rhs
+void greater_int32(RuntimeMachine *meta);
+
+// lhs rhs greater_equal_int32 -- lhs>=rhs
+void greater_equal_int32(RuntimeMachine *meta);
+
+/* 64-bit integer arithmetic, same conventions as int32 */
+
+// int64 int64 add_int64 -- int64
+void add_int64(RuntimeMachine *meta);
+
+// lhs rhs subtract_int64 -- lhs-rhs
+void subtract_int64(RuntimeMachine *meta);
+
+// int64 int64 multiply_int64 -- int64
+void multiply_int64(RuntimeMachine *meta);
+
+// lhs rhs divide_int64 -- lhs/rhs (truncated)
+void divide_int64(RuntimeMachine *meta);
+
+// lhs rhs modulo_int64 -- lhs%rhs (sign of lhs)
+void modulo_int64(RuntimeMachine *meta);
+
+// int64 negate_int64 -- -int64
+void negate_int64(RuntimeMachine *meta);
+
+// lhs rhs equal_int64 -- lhs==rhs
+void equal_int64(RuntimeMachine *meta);
+
+// lhs rhs not_equal_int64 -- lhs!=rhs
+void not_equal_int64(RuntimeMachine *meta);
+
+// lhs rhs less_int64 -- lhs<rhs
+void less_int64(RuntimeMachine *meta);
+
+// lhs rhs less_equal_int64 -- lhs<=rhs
+void less_equal_int64(RuntimeMachine *meta);
+
+// lhs rhs greater_int64 -- lhs>rhs
+void greater_int64(RuntimeMachine *meta);
+
+// lhs rhs greater_equal_int64 -- lhs>=rhs
+void greater_equal_int64(RuntimeMachine *meta);
+
+/* double precision arithmetic follows IEEE 754 and never raises */
+
+// float float add_float64 -- float
+void add_float64(RuntimeMachine *meta);
+
+// lhs rhs subtract_float64 -- lhs-rhs
+void subtract_float64(RuntimeMachine *meta);
+
+// float float multiply_float64 -- float
+void multiply_float64(RuntimeMachine *meta);
+
+// lhs rhs divide_float64 -- lhs/rhs
+void divide_float64(RuntimeMachine *meta);
+
+// float negate_float64 -- -float
+void negate_float64(RuntimeMachine *meta);
+
+// lhs rhs equal_float64 -- lhs==rhs
+void equal_float64(RuntimeMachine *meta);
+
+// lhs rhs not_equal_float64 -- lhs!=rhs
+void not_equal_float64(RuntimeMachine *meta);
+
+// lhs rhs less_float64 -- lhs<rhs
+void less_float64(RuntimeMachine *meta);
+
+// lhs rhs less_equal_float64 -- lhs<=rhs
+void less_equal_float64(RuntimeMachine *meta);
+
+// lhs rhs greater_float64 -- lhs>rhs
+void greater_float64(RuntimeMachine *meta);
+
+// lhs rhs greater_equal_float64 -- lhs>=rhs
+void greater_equal_float64(RuntimeMachine *meta);
+
+/* generic numeric instructions; mixed operands promote int32 < int64 < float64 */
+
+// number number add_number -- number
+void add_number(RuntimeMachine *meta);
+
+// lhs rhs subtract_number -- lhs-rhs
+void subtract_number(RuntimeMachine *meta);
+
+// number number multiply_number -- number
+void multiply_number(RuntimeMachine *meta);
+
+// lhs rhs divide_number -- lhs/rhs
+void divide_number(RuntimeMachine *meta);
+
+// lhs rhs modulo_number -- lhs%rhs
+void modulo_number(RuntimeMachine *meta);
+
+// number negate_number -- -number
+void negate_number(RuntimeMachine *meta);
+
+// lhs rhs equal_number -- lhs==rhs
+void equal_number(RuntimeMachine *meta);
+
+// lhs rhs less_number -- lhs<rhs
+void less_number(RuntimeMachine *meta);
+
+// number convert_to_int32 -- int
+void convert_to_int32(RuntimeMachine *meta);
+
+// number convert_to_int64 -- int64
+void convert_to_int64(RuntimeMachine *meta);
+
+// number convert_to_float64 -- float
+void convert_to_float64(RuntimeMachine *meta);
+
+/* arrays; element types are $0 int32, $1 int64, $2 float64, $3 byte */
+
+// length element_type create_array -- array
+void create_array(RuntimeMachine *meta);
+
+// array array_length -- int
+void array_length(RuntimeMachine *meta);
+
+// index array array_get -- value
+void array_get(RuntimeMachine *meta);
+
+// value index array array_set -- array
+void array_set(RuntimeMachine *meta);
+
+// start end array array_slice -- array (shares the buffer)
+void array_slice(RuntimeMachine *meta);
+
+// lhs rhs array_add -- array
+void array_add(RuntimeMachine *meta);
+
+// lhs rhs array_multiply -- array
+void array_multiply(RuntimeMachine *meta);
+
+// array array_sum -- number
+void array_sum(RuntimeMachine *meta);
+
+// array array_min -- value
+void array_min(RuntimeMachine *meta);
+
+// array array_max -- value
+void array_max(RuntimeMachine *meta);
+
+// value array array_fill -- array
+void array_fill(RuntimeMachine *meta);
+
+// source destination array_copy -- destination
+void array_copy(RuntimeMachine *meta);
+
+// value array array_find -- index (or $-1)
+void array_find(RuntimeMachine *meta);
+
+/* managed strings */
+
+// zstring make_string -- string
+void make_string(RuntimeMachine *meta);
+
+// string string_length -- int
+void string_length(RuntimeMachine *meta);
+
+// lhs rhs string_concatenate -- lhs+rhs
+void string_concatenate(RuntimeMachine *meta);
+
+// start end string string_slice -- string (shares the buffer)
+void string_slice(RuntimeMachine *meta);
+
+// haystack needle string_find -- index (or $-1)
+void string_find(RuntimeMachine *meta);
+
+// lhs rhs string_compare -- $-1, $0 or $1
+void string_compare(RuntimeMachine *meta);
+
+// lhs rhs string_equal -- lhs==rhs
+void string_equal(RuntimeMachine *meta);
+
+// string string_hash -- int
+void string_hash(RuntimeMachine *meta);
+
+/* jumps are relative to the cell following the offset, within the current CodeBlock */
+
+// jump_relative(offset) --
+void jump_relative(RuntimeMachine *meta);
+
+// int jump_if_zero(offset) --
+void jump_if_zero(RuntimeMachine *meta);
+
+// int jump_if_nonzero(offset) --
+void jump_if_nonzero(RuntimeMachine *meta);
+
 // exit_program --
 void exit_program(RuntimeMachine *meta);
 
@@ -29,8 +265,97 @@ void return_from_function(RuntimeMachine *meta);
 // procedure execute_stack_procedure -- 
 void execute_stack_procedure(RuntimeMachine *meta);
 
+/*
+	Errors unwind to the first handler of the faulting block that covers the
+	faulting cell, or else through the callers. Handlers are installed once,
+	so protected code runs at full speed; installing one again is a no-op,
+	and a procedure with a frame on the return stack cannot gain handlers.
+*/
+
+// begin end target depth procedure install_handler -- procedure
+void install_handler(RuntimeMachine *meta);
+
+// value raise_error --
+void raise_error(RuntimeMachine *meta);
+
+// error error_kind -- int
+void error_kind(RuntimeMachine *meta);
+
+// error error_value -- value
+void error_value(RuntimeMachine *meta);
+
+// error error_message -- string
+void error_message(RuntimeMachine *meta);
+
+// arguments... call_host_function(index) -- results...
+void call_host_function(RuntimeMachine *meta);
+
+/*
+	Non-blocking I/O on file descriptors (INT32 cells). An instruction that
+	would block leaves its operands in place and suspends the machine with
+	EXECUTION_WAITING_IO; on resume it runs again. Failures raise io_error.
+*/
+
+// path mode io_open -- fd (path: zstring or string; mode: IoOpenMode)
+void io_open(RuntimeMachine *meta);
+
+// host port io_connect -- fd (IPv4 address; suspends until connected, failures show on first use)
+void io_connect(RuntimeMachine *meta);
+
+// host port io_listen -- fd (port 0 picks a free one)
+void io_listen(RuntimeMachine *meta);
+
+// fd io_local_port -- port
+void io_local_port(RuntimeMachine *meta);
+
+// listener io_accept -- fd
+void io_accept(RuntimeMachine *meta);
+
+// buffer fd io_read -- count (reads into the byte array itself; 0 at end of input)
+void io_read(RuntimeMachine *meta);
+
+// data fd io_write -- count (data: array or string, written from its buffer; may be partial)
+void io_write(RuntimeMachine *meta);
+
+// fd io_close --
+void io_close(RuntimeMachine *meta);
+
 // key dynamic_execute_method -> self.key()
 //void dynamic_execute_method(RuntimeMachine *meta);
 
-std::string instructionAsString(Instruction i);
+
+/* instruction registry */
+
+enum InstructionFlags
+{
+	INSTRUCTION_BRANCH = 1,			// immediate is a relative jump offset
+	INSTRUCTION_CONDITIONAL = 2,	// branch that may also fall through
+	INSTRUCTION_TERMINATES = 4,		// never falls through to the next cell
+	INSTRUCTION_CALL = 8,			// pushes a stack frame
+	INSTRUCTION_INLINE_BODY = 16,	// immediate is a length, followed by that many cells
+	INSTRUCTION_UNCHECKED = 32,		// run inline, without checks, in verified blocks
+	INSTRUCTION_SUSPENDS = 64		// may stop the machine to wait, and run again on resume
+};
+
+struct InstructionInfo
+{
+	const char *name;
+	Instruction function;
+	unsigned int immediates;
+	int pops;
+	int pushes;
+	bool can_throw;
+	unsigned int flags;
+	const char *signature;
+};
+
+extern const InstructionInfo instruction_table[OPCODE_COUNT];
+
+// the opcode registered for function; throws UnknownFunctionError if there is none
+Opcode opcode_of(Instruction inst);
+
+// number of cells taken by the instruction at index, or 0 if it is malformed
+unsigned int instruction_width(const CodeBlock *block, unsigned int index);
+
+std::string instructionAsString(Opcode op);
 #endif
@@ -3,20 +3,47 @@
 
 #include <stack>
 #include <map>
+#include <unordered_set>
 #include <list>
+#include <vector>
 #include <string>
+#include <utility>
 #include <stdexcept>
+#include <exception>
+#include <atomic>
+#include <cstddef>
+#include <iosfwd>
 
 
 /* forward declarations */
 struct RuntimeMachine;
+struct NativeCode;
 struct Cell;
 class Object;
+struct Array;
+struct String;
+struct Error;
+class HostCall;
 
 
 /* an instruction is a pointer to a function of type void -> void */
 typedef void (*Instruction)(RuntimeMachine*);
 
+/* a native word; see embedding.hpp */
+typedef void (*HostFunction)(HostCall &call, void *data);
+
+/* dense instruction numbers; see opcodes.def and instruction_table */
+enum Opcode
+{
+	#define OPCODE(name, immediates, pops, pushes, can_throw, flags, signature) OP_##name,
+	#include "opcodes.def"
+	#undef OPCODE
+	OPCODE_COUNT
+};
+
+enum CellType { INT32, ADDRESS, ZSTRING, INSTRUCTION, PROCEDURE, OBJECT, INT64, FLOAT64, ARRAY, STRING, ERROR };
+const unsigned int CELL_TYPE_COUNT = ERROR + 1;
+
 /*
 	TODO: Keep track of memory.
 	- Storing strings in cells
@@ -26,8 +53,18 @@ typedef void (*Instruction)(RuntimeMachine*);
 
 class CellTypeException : public std::runtime_error
 {
+	std::string context;
+	CellType expected;
+	CellType received;
+	bool formatted;
+	mutable std::string message;
+
 	public:
 	CellTypeException(std::string msg);
+	/* the message is only built if what() is called */
+	CellTypeException(CellType expected, CellType received, std::string context);
+	~CellTypeException() noexcept {}
+	const char *what() const noexcept;
 };
 
 class NotImplementedError : public std::runtime_error
@@ -48,10 +85,41 @@ class UnknownFunctionError : public std::runtime_error
 	UnknownFunctionError(std::string msg);
 };
 
-class KeyNotFoundException : public std::runtime_error
+class ArithmeticError : public std::runtime_error
+{
+	public:
+	ArithmeticError(std::string msg);
+};
+
+/* a failed system call in an I/O instruction; the message includes strerror */
+class IoError : public std::runtime_error
+{
+	public:
+	IoError(std::string msg);
+};
+
+/* an allocation the heap limit refused; see GarbageCollector::reserve */
+class HeapLimitError : public std::runtime_error
 {
 	public:
-	KeyNotFoundException(std::string msg);
+	HeapLimitError(std::string msg);
+};
+
+/* an error raised by bytecode that no handler caught */
+class UncaughtError : public std::runtime_error
+{
+	public:
+	UncaughtError(std::string msg);
+};
+
+
+/* bytecode catch clause: a fault in cells [begin, end) resumes at target with the error on top */
+struct ExceptionHandler
+{
+	unsigned int begin;
+	unsigned int end;
+	unsigned int target;
+	int depth;		// operand stack height kept, relative to the frame's base
 };
 
 
@@ -60,40 +128,91 @@ struct CodeBlock
 	unsigned int size;
 	Cell *text;
 
+	/* JIT bookkeeping: calls and backward jumps taken, and the compiled code once hot */
+	mutable unsigned int call_count;
+	mutable NativeCode *native;
+
+	/* set once verify_procedure has proven the block; it then runs unchecked */
+	mutable bool verified;
+
+	/*
+		Left by compile_procedure until the first call: the cells are still
+		in source's text from source_offset on, and are copied, resolved and
+		verified by RuntimeMachine::resolve_procedure. NULL once resolved.
+	*/
+	mutable const CodeBlock *source;
+	mutable unsigned int source_offset;
+
+	/* the block's cells, read from source while it is unresolved; for tools that only read */
+	const Cell *cells() const;
+
+	/* searched in order when an error unwinds through this block */
+	std::vector<ExceptionHandler> handlers;
+
 	CodeBlock(unsigned int s, Cell *txt);
+	~CodeBlock();
+	void add_handler(const ExceptionHandler &handler);
+	const ExceptionHandler *find_handler(unsigned int index) const;
 	std::string toString() const;
 };
 
-enum CellType { INT32, ADDRESS, ZSTRING, INSTRUCTION, PROCEDURE, OBJECT };
-
 struct Cell {
 	union {
 		int int32;
+		long long int64;
+		double float64;
 		Cell *address;
-		Instruction instruction;
+		Opcode opcode;
 		char *string;
 		CodeBlock *procedure;
 		Object* object;
+		Array *array;
+		String *str;
+		Error *error;
 	};
 	CellType type;
 	Cell();
 	Cell(const Cell &other);
 	Cell(int i);
+	Cell(long long i);
+	Cell(double d);
 	Cell(char *s);
 	Cell(Cell* other);
 	Cell(Instruction inst);
+	Cell(Opcode op);
 	Cell(CodeBlock *code);
 	Cell(Object *obj);
+	Cell(Array *arr);
+	Cell(String *s);
+	Cell(Error *e);
 
 	bool operator==(const Cell &other) const;
 	bool operator<(const Cell &other) const;
 	void assert_type(CellType t, std::string msg);
+	void assert_type(CellType t, const char *msg)
+	{
+		if (type != t) assert_type(t, std::string(msg));
+	}
 	std::string toString() const;
 
 	static std::string typeAsString(CellType t);
 };
 
 
+class KeyNotFoundException : public std::runtime_error
+{
+	mutable std::string message;
+
+	public:
+	Cell key;
+
+	/* the message is only built if what() is called */
+	KeyNotFoundException(Cell k);
+	~KeyNotFoundException() noexcept {}
+	const char *what() const noexcept;
+};
+
+
 struct ObjectIterator
 {
 	std::list<Cell>::iterator key;
@@ -105,13 +224,21 @@ struct ObjectIterator
 	bool operator!=(const ObjectIterator &other);
 };
 
+/* (key, previous value) pairs recorded by Object::setattr */
+typedef std::vector<std::pair<Cell, Cell> > AttributeJournal;
+
 class Object
 {
 	std::list<Cell> keys;
 	std::list<Cell> values;
+	AttributeJournal *journal;
 
 	public:
+	Object() : journal(NULL) {}
 	unsigned int size();
+	void restore_size(unsigned int count);
+	/* while journal is set, setattr records every value it replaces there; NULL stops it */
+	void set_journal(AttributeJournal *j) { journal = j; }
 	void setattr(Cell key, Cell value);
 	Cell getattr(Cell key);
 
@@ -122,11 +249,114 @@ class Object
 };
 
 
+enum ElementType { ELEMENT_INT32, ELEMENT_INT64, ELEMENT_FLOAT64, ELEMENT_BYTE };
+
+/*
+	Contiguous buffer of unboxed elements. A slice shares the buffer of the
+	array that owns it; owner is NULL for the owning array itself.
+*/
+struct Array
+{
+	ElementType element_type;
+	unsigned int length;
+	unsigned char *data;
+	Array *owner;
+
+	Array(ElementType t, unsigned int len, unsigned char *buffer, Array *own);
+
+	Cell get(unsigned int index) const;
+	void set(unsigned int index, Cell value);
+
+	/* bulk operations, dispatched to the SIMD kernels */
+	void add(const Array *lhs, const Array *rhs);
+	void multiply(const Array *lhs, const Array *rhs);
+	Cell sum() const;
+	Cell min() const;
+	Cell max() const;
+	void fill(Cell value);
+	void copy_from(const Array *source);
+	int find(Cell value) const;
+
+	std::string toString() const;
+
+	static unsigned int elementSize(ElementType t);
+	/* bytes taken by length elements; throws ExecutionOutOfBoundsError if that does not fit a size_t */
+	static size_t byteSize(ElementType t, unsigned int length);
+	static std::string elementTypeAsString(ElementType t);
+};
+
+
+/* character storage shared by every String that views part of it */
+struct StringBuffer
+{
+	char *data;
+	unsigned int used;
+	unsigned int capacity;
+	unsigned int references;
+};
+
+/*
+	Immutable, length-prefixed string. Slices share the buffer of the string
+	they were cut from; the hash is computed on first use and cached.
+*/
+struct String
+{
+	StringBuffer *buffer;
+	unsigned int offset;
+	unsigned int length;
+	mutable unsigned int hash_value;
+
+	String(StringBuffer *buf, unsigned int off, unsigned int len);
+
+	const char *data() const { return buffer->data + offset; }
+	unsigned int hash() const;
+	bool equals(const String *other) const;
+	int compare(const String *other) const;
+	int find(const String *needle) const;
+
+	std::string toString() const;
+};
+
+
+enum ErrorKind
+{
+	ERROR_TYPE,
+	ERROR_KEY_NOT_FOUND,
+	ERROR_OUT_OF_BOUNDS,
+	ERROR_UNKNOWN_FUNCTION,
+	ERROR_NOT_IMPLEMENTED,
+	ERROR_ARITHMETIC,
+	ERROR_RAISED,
+	ERROR_IO,
+	ERROR_HEAP_LIMIT
+};
+
+/*
+	Error value seen by bytecode handlers. Faults keep the C++ exception that
+	caused them and only format its message when it is read; raised errors
+	carry the value passed to raise_error.
+*/
+struct Error
+{
+	ErrorKind kind;
+	Cell value;
+	std::exception_ptr cause;
+
+	Error(ErrorKind k, Cell v, std::exception_ptr c);
+
+	std::string message() const;
+	std::string toString() const;
+
+	static std::string kindAsString(ErrorKind k);
+};
+
+
 struct StackFrame
 {
 	const CodeBlock *code;
 	Object *context;
 	Cell *location_pointer;
+	unsigned int stack_base;	// argument stack height when the frame was entered
 
 	StackFrame(const CodeBlock *block, Object *context, Cell *raddr);
 	StackFrame(const StackFrame &other);
@@ -151,24 +381,181 @@ class Dictionary
 };
 
 
+/* orders managed cells by the address of their payload, never by contents */
+struct CellIdentityLess
+{
+	bool operator()(const Cell &lhs, const Cell &rhs) const
+	{
+		if (lhs.type != rhs.type) return lhs.type < rhs.type;
+		return lhs.address < rhs.address;
+	}
+};
+
+/* bits of ExecutionLimits::pending */
+enum LimitFlag { LIMIT_INTERRUPT = 1, LIMIT_HEAP = 2 };
+
+/*
+	Budgets checked at safepoints: backward jumps and calls. fuel is spent one
+	unit per safepoint; pending is the only field other threads may touch.
+	Native code reads both at fixed offsets, so keep the layout.
+*/
+struct ExecutionLimits
+{
+	long long fuel;
+	std::atomic<int> pending;
+};
+
+enum ExecutionStatus { EXECUTION_FINISHED, EXECUTION_OUT_OF_FUEL, EXECUTION_HEAP_LIMIT, EXECUTION_INTERRUPTED, EXECUTION_WAITING_IO };
+
+/* readiness an I/O instruction is waiting for; see io.hpp */
+enum IoEvent { IO_READABLE = 1, IO_WRITABLE = 2 };
+
+
+/* allocation counters for one CellType; live = allocated - freed */
+struct TypeStatistics
+{
+	unsigned long long allocated;
+	unsigned long long allocated_bytes;
+	unsigned long long freed;
+	unsigned long long freed_bytes;
+};
+
+/* one call to GarbageCollector::collect; times are in nanoseconds */
+struct CollectionStatistics
+{
+	unsigned long long sequence;		// 1 for the first collection
+	unsigned long long mark_time;
+	unsigned long long sweep_time;
+	unsigned long long pause_time;
+	size_t heap_before;
+	size_t heap_after;
+	unsigned long long marked;
+	unsigned long long freed;
+	unsigned int threads;			// markers and sweepers, the collecting thread included
+};
+
+struct HeapStatistics
+{
+	TypeStatistics types[CELL_TYPE_COUNT];
+	size_t heap_bytes;
+	unsigned long long live_objects;
+
+	unsigned long long collections;
+	unsigned long long total_pause_time;
+	unsigned long long max_pause_time;
+	CollectionStatistics last;
+
+	/* arena allocations, and how many of them promote moved into the collected heap */
+	unsigned long long arena_allocated;
+	unsigned long long promoted;
+
+	double promotion_rate() const { return arena_allocated == 0 ? 0.0 : static_cast<double>(promoted) / arena_allocated; }
+};
+
+/* called at the end of every collection, on the thread that ran it */
+typedef void (*CollectionCallback)(const CollectionStatistics &collection, void *data);
+
 class GarbageCollector
 {
-	std::map<Cell, bool> storage;
+	public:
+	/* every collected cell and its mark bit; parallel markers set the bits concurrently */
+	typedef std::map<Cell, std::atomic<bool>, CellIdentityLess> Storage;
+
+	private:
+	Storage storage;
+	unsigned int marker_threads;
+
+	/* bytes held by managed cells, counted where they are allocated and freed */
+	size_t heap_bytes;
+	size_t heap_limit;
+	std::atomic<int> *limit_signal;
+
+	/* allocations made while an arena is active skip storage and die together */
+	std::vector<Cell> arena;
+	/* payload addresses of arena cells still to be freed, so in_arena is a lookup */
+	std::unordered_set<const void*> arena_members;
+	bool arena_active;
+
+	HeapStatistics stats;
+	unsigned long long marked_cells;
+	CollectionCallback collection_callback;
+	void *collection_data;
+
+	void reserve(size_t bytes) const;
+	void track(Cell c, size_t bytes);
+	void dispose(Cell c);
 
 	public:
+	GarbageCollector();
+	~GarbageCollector();
+
+	/*
+		Raises LIMIT_HEAP in signal whenever an allocation leaves the heap
+		above limit, and refuses the allocations reserve() rules out; 0 is
+		unlimited.
+	*/
+	void set_heap_limit(size_t limit, std::atomic<int> *signal);
+	size_t heap_size() const { return heap_bytes; }
+	bool over_heap_limit() const { return heap_limit != 0 && heap_bytes > heap_limit; }
+
 	void mark(Cell c);
+	void mark_arena();
 	void sweep();
+	void parallel_sweep(unsigned int threads);
+	/* mark from roots and the arena, then sweep, recording the collection */
+	void collect(const std::vector<Cell> &roots);
+
+	/*
+		Threads that mark and sweep a collection, the collecting one included;
+		1 (the default) collects serially, 0 uses one per hardware thread.
+		Small heaps are always collected serially.
+	*/
+	void set_marker_threads(unsigned int threads);
+
+	/* counters since construction; a copy, so it can be kept and compared */
+	HeapStatistics statistics() const;
+	void set_collection_callback(CollectionCallback callback, void *data);
+
+	/*
+		Writes the graph reachable from roots and the arena as JSON: every
+		managed cell with its size, outgoing references, immediate dominator
+		and retained size, followed by per-type totals and the largest
+		retainers.
+	*/
+	void dump_heap(std::ostream &output, const std::vector<Cell> &roots) const;
+
+	void begin_arena();
+	void end_arena();
+	void promote(Cell root);
+	/* true if c dies at end_arena; false without an open arena */
+	bool in_arena(Cell c) const;
+	/* true if c was allocated here, in the heap or the arena, and not by the host */
+	bool manages(Cell c) const;
 
 	Object* create_object();
 	CodeBlock* create_procedure(unsigned int);
+	Array* create_array(ElementType t, unsigned int length);
+	Array* create_array_slice(Array *parent, unsigned int start, unsigned int length);
 	char* duplicate_string(const char *cpy);
-	//char *create_string(char *current);
+	String* create_managed_string(const char *chars, unsigned int length);
+	String* create_string_slice(String *parent, unsigned int start, unsigned int length);
+	String* create_string_concatenation(String *lhs, String *rhs);
+	Error* create_error(ErrorKind kind, Cell value, std::exception_ptr cause);
 };
 
 
 
+struct HostBinding
+{
+	HostFunction function;
+	void *data;
+	unsigned int arity;
+};
+
 class RuntimeMachine
 {
+	friend class HostCall;
+
 	/* data */
 	#ifdef DEBUG
 	public:
@@ -176,12 +563,24 @@ class RuntimeMachine
 
 	GarbageCollector object_storage;
 
-	std::list<Cell> argument_stack;
+	std::vector<Cell> argument_stack;
 	std::list<StackFrame> return_stack;
 
 	bool continue_execution;
+	bool jit_enabled;
+
+	ExecutionLimits limits;
+	bool fuel_limited;
+	ExecutionStatus execution_status;
+	int io_descriptor;
+	unsigned int io_events;
 
 	Object *global_object;
+	unsigned int request_globals;
+	AttributeJournal request_overwrites;
+
+	/* indexed by the immediate of call_host_function */
+	std::vector<HostBinding> host_functions;
 
 
 	public:
@@ -189,28 +588,105 @@ class RuntimeMachine
 	~RuntimeMachine();
 	Cell execute(const CodeBlock *target);
 
+	/*
+		Resource limits. When one runs out, execute and resume return early
+		with status() saying why; the frames and operand stack are kept, so
+		after raising the limit resume() carries on where it stopped. An
+		allocation that could never fit under the heap limit is refused up
+		front instead, as a heap_limit error bytecode can catch.
+	*/
+	ExecutionStatus status() const { return execution_status; }
+	Cell resume();
+	void set_fuel(unsigned long long units);		// 0 is unlimited
+	void set_heap_limit(size_t bytes);		// 0 is unlimited
+	size_t heap_size() const { return object_storage.heap_size(); }
+	/* safe to call from any thread; takes effect at the next safepoint */
+	void interrupt();
+
+	/*
+		Status EXECUTION_WAITING_IO: an I/O instruction would have blocked on
+		waiting_descriptor(). Resume once it is ready for waiting_events(),
+		which an EventLoop does for the machines it runs.
+	*/
+	int waiting_descriptor() const { return io_descriptor; }
+	unsigned int waiting_events() const { return io_events; }
+
 	StackFrame &current_stack_frame();
+	/* true if code has a frame on the return stack */
+	bool is_running(const CodeBlock *code) const;
 
-	CodeBlock* lookup_word(std::string name);
+	CodeBlock* lookup_word(const std::string &name);
 	void define_word(std::string name, CodeBlock* code);
+	/* defines name as a word that calls function with arity arguments; returns its procedure */
+	CodeBlock* define_host_function(const std::string &name, unsigned int arity, HostFunction function, void *data = NULL);
 
 	CodeBlock* create_anonymous_procedure(unsigned int length);
 	Object* create_object();
 	char* create_string(const char *other);
-	
+	Array* create_array(ElementType t, unsigned int length);
+	Array* create_array_slice(Array *parent, unsigned int start, unsigned int length);
+	String* create_managed_string(const char *chars, unsigned int length);
+	String* create_string_slice(String *parent, unsigned int start, unsigned int length);
+	String* create_string_concatenation(String *lhs, String *rhs);
+	Error* create_error(ErrorKind kind, Cell value, std::exception_ptr cause);
+
 
 	void push_argument(Cell c);
 	Cell pop_argument();
+	bool try_pop_int32(int *value);
 	Cell read_byte();
+	void jump_relative(int offset);
 	void halt();
 
-	void compile_next_instruction(CodeBlock*, int index);
+	/* finishes a procedure compile_procedure left unresolved; see CodeBlock::source */
+	void resolve_procedure(const CodeBlock *code);
+	void resolve_if_lazy(const CodeBlock *code)
+	{
+		if (code->source != NULL) resolve_procedure(code);
+	}
 
+	void run();
 	void execute_next_instruction();
+	void execute_checked_instruction();
+	void execute_verified(StackFrame &frame);
+	bool count_backward_jump(const CodeBlock *code, const Cell *target);
+
+	/* spends one unit of fuel; true if execution has just been suspended */
+	bool at_safepoint()
+	{
+		if (limits.fuel-- > 0 && limits.pending.load(std::memory_order_relaxed) == 0) return false;
+		return check_limits();
+	}
+	bool check_limits();
+	ExecutionLimits *execution_limits() { return &limits; }
+	/* suspends with EXECUTION_WAITING_IO; called by instructions that would block */
+	void wait_for_io(int descriptor, unsigned int events);
 	void call_function(Object *context, const CodeBlock *block);
+	void call_host_function(unsigned int index);
 	void restore_stack_frame();
 
+	void raise_error(Error *error);
+	void raise_exception(ErrorKind kind, Cell value);
+
+	void set_jit_enabled(bool enabled);
+
+	void gc_roots(std::vector<Cell> &roots) const;
 	void collect_garbage();
+	/* see GarbageCollector::set_marker_threads */
+	void set_gc_threads(unsigned int threads) { object_storage.set_marker_threads(threads); }
+	bool is_managed(Cell c) const { return object_storage.manages(c); }
 	void reset();
+
+	/* GC telemetry; see HeapStatistics and GarbageCollector::dump_heap */
+	HeapStatistics heap_statistics() const { return object_storage.statistics(); }
+	void set_collection_callback(CollectionCallback callback, void *data);
+	void dump_heap(std::ostream &output) const;
+	/* throws std::runtime_error if the file cannot be written */
+	void dump_heap(const std::string &path) const;
+
+	/* per-request arenas: see MachinePool */
+	void begin_request();
+	void end_request();
+	Cell promote(Cell c);
 };
 #endif
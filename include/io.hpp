@@ -0,0 +1,67 @@
+#ifndef io_hpp
+#define io_hpp
+
+#include <vector>
+#include <exception>
+
+#include "interpreter.hpp"
+
+/* the mode operand of io_open */
+enum IoOpenMode { IO_OPEN_READ, IO_OPEN_WRITE, IO_OPEN_APPEND };
+
+/* called once per machine the loop stops running; error is null unless it threw */
+typedef void (*CompletionCallback)(RuntimeMachine *machine, std::exception_ptr error, void *data);
+
+/*
+	Runs many RuntimeMachines on one thread over epoll (Linux). Each machine
+	is an execution context: when one of its I/O instructions would block it
+	suspends with EXECUTION_WAITING_IO, the loop watches that descriptor, and
+	resumes the machine once it is ready. A machine that stops for any other
+	reason (finished, out of fuel, threw) is handed to the completion
+	callback and forgotten; schedule() takes it back.
+
+	Only one machine may wait on a descriptor at a time. Regular files are
+	always ready, so I/O on them completes without suspending.
+*/
+class EventLoop
+{
+	int epoll_descriptor;
+	std::vector<RuntimeMachine*> watchers;		// indexed by descriptor
+	unsigned int waiting;
+	std::vector<RuntimeMachine*> ready;
+	CompletionCallback completion;
+	void *completion_data;
+
+	EventLoop(const EventLoop&);
+	EventLoop &operator=(const EventLoop&);
+
+	void watch(RuntimeMachine *machine);
+	void dispatch(RuntimeMachine *machine);
+	void finish(RuntimeMachine *machine, std::exception_ptr error);
+	void resume(RuntimeMachine *machine);
+
+	public:
+	/* throws IoError if epoll is unavailable */
+	EventLoop();
+	~EventLoop();
+
+	void set_completion_callback(CompletionCallback callback, void *data);
+
+	/* runs code on machine until it first suspends or stops */
+	void start(RuntimeMachine *machine, const CodeBlock *code);
+	/* resumes a suspended machine on the next turn, e.g. after refuelling it */
+	void schedule(RuntimeMachine *machine);
+
+	/*
+		One turn: resumes the scheduled machines, then those whose descriptors
+		became ready, waiting up to timeout milliseconds (-1 is forever) only
+		if nothing was runnable. Returns the number of machines resumed.
+	*/
+	unsigned int run_once(int timeout);
+	/* turns until no machine is waiting or scheduled */
+	void run();
+
+	unsigned int pending() const { return waiting + ready.size(); }
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef jit_hpp
+#define jit_hpp
+#include "interpreter.hpp"
+
+/*
+	Baseline template JIT for x86-64 Linux. A hot CodeBlock is translated cell
+	by cell into machine code; int32 stack traffic is kept in callee-saved
+	registers, also across loop back-edges, and load_immediate constants are
+	folded into the code. Cells the JIT does not handle return control to the
+	interpreter, which resumes the frame at that cell and re-enters native
+	code at the next entry point. Blocks whose loops would leave native code
+	on every iteration are not compiled.
+*/
+
+/* calls plus backward jumps a block takes before it is compiled */
+const unsigned int JIT_THRESHOLD = 100;
+
+struct NativeCode;
+
+/* never returns NULL; blocks with nothing to compile get a code object with no entry points */
+NativeCode* jit_compile(const CodeBlock *block);
+void jit_release(NativeCode *code);
+/* true if native code can be entered at the cell with this index */
+bool jit_can_enter(const NativeCode *code, unsigned int index);
+
+/*
+	Runs native code for the frame if its location is an entry point and
+	updates the location pointer to where the interpreter must continue.
+	Exceptions raised by instructions called from native code are rethrown
+	here with the location just past the faulting cell, as in the interpreter.
+*/
+void jit_enter(RuntimeMachine *meta, StackFrame &frame);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef pool_hpp
+#define pool_hpp
+
+#include <vector>
+#include <mutex>
+
+#include "interpreter.hpp"
+
+/*
+	Pre-warmed RuntimeMachines for short-lived requests. acquire() hands out
+	an idle machine with a request arena open; release() tears the arena down
+	and puts the machine back, so no request pays for building a machine or
+	for a full collection. The prelude, if any, runs once per machine when it
+	is built and its definitions persist across requests. Machines run their
+	own copies of it, so the pool only ever reads the prelude block.
+*/
+class MachinePool
+{
+	std::vector<RuntimeMachine*> idle;
+	std::mutex lock;
+	const CodeBlock *prelude;
+	unsigned int capacity;
+
+	RuntimeMachine* build();
+
+	public:
+	MachinePool(unsigned int prewarm, unsigned int capacity, const CodeBlock *prelude = NULL);
+	~MachinePool();
+
+	RuntimeMachine* acquire();
+	void release(RuntimeMachine *machine);
+};
+
+/* acquires a machine for the lifetime of the lease */
+class MachineLease
+{
+	MachinePool &pool;
+	RuntimeMachine *machine;
+
+	MachineLease(const MachineLease&);
+	MachineLease& operator=(const MachineLease&);
+
+	public:
+	MachineLease(MachinePool &p) : pool(p), machine(p.acquire()) {}
+	~MachineLease() { pool.release(machine); }
+
+	RuntimeMachine* operator->() const { return machine; }
+	RuntimeMachine& operator*() const { return *machine; }
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef simd_hpp
+#define simd_hpp
+
+/*
+	Bulk kernels over contiguous element buffers, used by the ARRAY instructions.
+	Integer element-wise arithmetic wraps modulo the element width; min/max/sum
+	expect n > 0 and find returns -1 when the value is absent. Float64 min/max
+	return the first NaN in the buffer if it holds any, in every kernel set.
+*/
+struct ArrayKernels
+{
+	const char *name;
+
+	void (*add_int32)(int *dst, const int *lhs, const int *rhs, unsigned int n);
+	void (*add_int64)(long long *dst, const long long *lhs, const long long *rhs, unsigned int n);
+	void (*add_float64)(double *dst, const double *lhs, const double *rhs, unsigned int n);
+	void (*add_byte)(unsigned char *dst, const unsigned char *lhs, const unsigned char *rhs, unsigned int n);
+
+	void (*multiply_int32)(int *dst, const int *lhs, const int *rhs, unsigned int n);
+	void (*multiply_int64)(long long *dst, const long long *lhs, const long long *rhs, unsigned int n);
+	void (*multiply_float64)(double *dst, const double *lhs, const double *rhs, unsigned int n);
+	void (*multiply_byte)(unsigned char *dst, const unsigned char *lhs, const unsigned char *rhs, unsigned int n);
+
+	long long (*sum_int32)(const int *src, unsigned int n);
+	long long (*sum_int64)(const long long *src, unsigned int n);
+	double (*sum_float64)(const double *src, unsigned int n);
+	long long (*sum_byte)(const unsigned char *src, unsigned int n);
+
+	int (*min_int32)(const int *src, unsigned int n);
+	long long (*min_int64)(const long long *src, unsigned int n);
+	double (*min_float64)(const double *src, unsigned int n);
+	unsigned char (*min_byte)(const unsigned char *src, unsigned int n);
+
+	int (*max_int32)(const int *src, unsigned int n);
+	long long (*max_int64)(const long long *src, unsigned int n);
+	double (*max_float64)(const double *src, unsigned int n);
+	unsigned char (*max_byte)(const unsigned char *src, unsigned int n);
+
+	long (*find_int32)(const int *src, unsigned int n, int value);
+	long (*find_int64)(const long long *src, unsigned int n, long long value);
+	long (*find_float64)(const double *src, unsigned int n, double value);
+	long (*find_byte)(const unsigned char *src, unsigned int n, unsigned char value);
+};
+
+/* best kernel set for the running CPU, chosen once on first use */
+const ArrayKernels &array_kernels();
+
+/* portable reference kernels, always available */
+const ArrayKernels &scalar_array_kernels();
+
+#endif
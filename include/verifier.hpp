@@ -0,0 +1,23 @@
+#ifndef verifier_hpp
+#define verifier_hpp
+
+#include "interpreter.hpp"
+
+/*
+	Abstract interpretation over the operand stack of a single block. The
+	stack below the block's entry, and everything after a call, is unknown;
+	on top of it the verifier tracks the depth and type of every cell the
+	block pushed itself. A block passes when
+
+	- every cell decodes, and control never runs off the end,
+	- every jump lands on an instruction boundary inside the block,
+	- the tracked depth agrees wherever control flow merges, and
+	- every INSTRUCTION_UNCHECKED instruction finds its operands among the
+	  tracked cells, with the types its signature asks for.
+
+	Passing blocks are marked verified and run without per-instruction
+	checks; anything else keeps the checked interpreter.
+*/
+bool verify_procedure(const CodeBlock *block);
+
+#endif
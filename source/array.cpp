@@ -0,0 +1,256 @@
+#include "interpreter.hpp"
+#include "simd.hpp"
+
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <cstdint>
+
+
+Array::Array(ElementType t, unsigned int len, unsigned char *buffer, Array *own)
+: element_type(t), length(len), data(buffer), owner(own) {}
+
+unsigned int Array::elementSize(ElementType t)
+{
+	switch (t)
+	{
+		case ELEMENT_INT32: return sizeof(int);
+		case ELEMENT_INT64: return sizeof(long long);
+		case ELEMENT_FLOAT64: return sizeof(double);
+		case ELEMENT_BYTE:
+		default: return sizeof(unsigned char);
+	}
+}
+
+size_t Array::byteSize(ElementType t, unsigned int length)
+{
+	size_t size = elementSize(t);
+	if (length > SIZE_MAX / size) throw ExecutionOutOfBoundsError("Array - length too large");
+	return static_cast<size_t>(length) * size;
+}
+
+std::string Array::elementTypeAsString(ElementType t)
+{
+	switch (t)
+	{
+		case ELEMENT_INT32: return std::string("int32");
+		case ELEMENT_INT64: return std::string("int64");
+		case ELEMENT_FLOAT64: return std::string("float64");
+		case ELEMENT_BYTE:
+		default: return std::string("byte");
+	}
+}
+
+static void array_index_error(unsigned int index, unsigned int length)
+{
+	std::stringstream output;
+	output << "Array index " << index << " out of bounds for length " << length;
+	throw ExecutionOutOfBoundsError(output.str());
+}
+
+/* the cell type each element type is read and written as */
+static CellType element_cell_type(ElementType t)
+{
+	switch (t)
+	{
+		case ELEMENT_INT64: return INT64;
+		case ELEMENT_FLOAT64: return FLOAT64;
+		case ELEMENT_INT32:
+		case ELEMENT_BYTE:
+		default: return INT32;
+	}
+}
+
+Cell Array::get(unsigned int index) const
+{
+	if (index >= length) array_index_error(index, length);
+	switch (element_type)
+	{
+		case ELEMENT_INT32: return Cell(reinterpret_cast<const int*>(data)[index]);
+		case ELEMENT_INT64: return Cell(reinterpret_cast<const long long*>(data)[index]);
+		case ELEMENT_FLOAT64: return Cell(reinterpret_cast<const double*>(data)[index]);
+		case ELEMENT_BYTE:
+		default: return Cell(static_cast<int>(data[index]));
+	}
+}
+
+void Array::set(unsigned int index, Cell value)
+{
+	if (index >= length) array_index_error(index, length);
+	value.assert_type(element_cell_type(element_type), "Array::set.value");
+	switch (element_type)
+	{
+		case ELEMENT_INT32: reinterpret_cast<int*>(data)[index] = value.int32; break;
+		case ELEMENT_INT64: reinterpret_cast<long long*>(data)[index] = value.int64; break;
+		case ELEMENT_FLOAT64: reinterpret_cast<double*>(data)[index] = value.float64; break;
+		case ELEMENT_BYTE:
+		default: {
+			if (value.int32 < 0 || value.int32 > 255)
+			{
+				std::stringstream output;
+				output << "Byte value " << value.int32 << " out of range in Array::set";
+				throw ArithmeticError(output.str());
+			}
+			data[index] = static_cast<unsigned char>(value.int32);
+			break;
+		}
+	}
+}
+
+static void array_shape_error(const char *name, const Array *lhs, const Array *rhs)
+{
+	std::stringstream output;
+	output << "Mismatched arrays in " << name << " - "
+		<< Array::elementTypeAsString(lhs->element_type) << "[" << lhs->length << "] and "
+		<< Array::elementTypeAsString(rhs->element_type) << "[" << rhs->length << "]";
+	throw CellTypeException(output.str());
+}
+
+#define as_int32(a) reinterpret_cast<int*>((a)->data)
+#define as_int64(a) reinterpret_cast<long long*>((a)->data)
+#define as_float64(a) reinterpret_cast<double*>((a)->data)
+
+void Array::add(const Array *lhs, const Array *rhs)
+{
+	if (lhs->element_type != element_type || rhs->element_type != element_type || lhs->length != length || rhs->length != length)
+	{
+		array_shape_error("Array::add", lhs, rhs);
+	}
+	const ArrayKernels &k = array_kernels();
+	switch (element_type)
+	{
+		case ELEMENT_INT32: k.add_int32(as_int32(this), as_int32(lhs), as_int32(rhs), length); break;
+		case ELEMENT_INT64: k.add_int64(as_int64(this), as_int64(lhs), as_int64(rhs), length); break;
+		case ELEMENT_FLOAT64: k.add_float64(as_float64(this), as_float64(lhs), as_float64(rhs), length); break;
+		case ELEMENT_BYTE: k.add_byte(data, lhs->data, rhs->data, length); break;
+	}
+}
+
+void Array::multiply(const Array *lhs, const Array *rhs)
+{
+	if (lhs->element_type != element_type || rhs->element_type != element_type || lhs->length != length || rhs->length != length)
+	{
+		array_shape_error("Array::multiply", lhs, rhs);
+	}
+	const ArrayKernels &k = array_kernels();
+	switch (element_type)
+	{
+		case ELEMENT_INT32: k.multiply_int32(as_int32(this), as_int32(lhs), as_int32(rhs), length); break;
+		case ELEMENT_INT64: k.multiply_int64(as_int64(this), as_int64(lhs), as_int64(rhs), length); break;
+		case ELEMENT_FLOAT64: k.multiply_float64(as_float64(this), as_float64(lhs), as_float64(rhs), length); break;
+		case ELEMENT_BYTE: k.multiply_byte(data, lhs->data, rhs->data, length); break;
+	}
+}
+
+/* integer sums are widened to int64; float sums may round differently from a sequential loop */
+Cell Array::sum() const
+{
+	const ArrayKernels &k = array_kernels();
+	switch (element_type)
+	{
+		case ELEMENT_INT32: return Cell(k.sum_int32(as_int32(this), length));
+		case ELEMENT_INT64: return Cell(k.sum_int64(as_int64(this), length));
+		case ELEMENT_FLOAT64: return Cell(k.sum_float64(as_float64(this), length));
+		case ELEMENT_BYTE:
+		default: return Cell(k.sum_byte(data, length));
+	}
+}
+
+Cell Array::min() const
+{
+	if (length == 0) throw ExecutionOutOfBoundsError(std::string("Array::min of empty array"));
+	const ArrayKernels &k = array_kernels();
+	switch (element_type)
+	{
+		case ELEMENT_INT32: return Cell(k.min_int32(as_int32(this), length));
+		case ELEMENT_INT64: return Cell(k.min_int64(as_int64(this), length));
+		case ELEMENT_FLOAT64: return Cell(k.min_float64(as_float64(this), length));
+		case ELEMENT_BYTE:
+		default: return Cell(static_cast<int>(k.min_byte(data, length)));
+	}
+}
+
+Cell Array::max() const
+{
+	if (length == 0) throw ExecutionOutOfBoundsError(std::string("Array::max of empty array"));
+	const ArrayKernels &k = array_kernels();
+	switch (element_type)
+	{
+		case ELEMENT_INT32: return Cell(k.max_int32(as_int32(this), length));
+		case ELEMENT_INT64: return Cell(k.max_int64(as_int64(this), length));
+		case ELEMENT_FLOAT64: return Cell(k.max_float64(as_float64(this), length));
+		case ELEMENT_BYTE:
+		default: return Cell(static_cast<int>(k.max_byte(data, length)));
+	}
+}
+
+void Array::fill(Cell value)
+{
+	if (length == 0) return;
+	/* write one element through set() for the checks, then double the filled prefix */
+	set(0, value);
+	size_t size = elementSize(element_type);
+	size_t total = byteSize(element_type, length);
+	size_t filled = size;
+	while (filled < total)
+	{
+		size_t chunk = filled < total - filled ? filled : total - filled;
+		memcpy(data + filled, data, chunk);
+		filled += chunk;
+	}
+}
+
+void Array::copy_from(const Array *source)
+{
+	if (source->element_type != element_type)
+	{
+		array_shape_error("Array::copy_from", source, this);
+	}
+	unsigned int count = source->length < length ? source->length : length;
+	/* slices of one buffer may overlap */
+	memmove(data, source->data, byteSize(element_type, count));
+}
+
+int Array::find(Cell value) const
+{
+	const ArrayKernels &k = array_kernels();
+	switch (element_type)
+	{
+		case ELEMENT_INT32: {
+			if (value.type != INT32) return -1;
+			return static_cast<int>(k.find_int32(as_int32(this), length, value.int32));
+		}
+		case ELEMENT_INT64: {
+			if (value.type != INT64) return -1;
+			return static_cast<int>(k.find_int64(as_int64(this), length, value.int64));
+		}
+		case ELEMENT_FLOAT64: {
+			if (value.type != FLOAT64) return -1;
+			return static_cast<int>(k.find_float64(as_float64(this), length, value.float64));
+		}
+		case ELEMENT_BYTE:
+		default: {
+			if (value.type != INT32 || value.int32 < 0 || value.int32 > 255) return -1;
+			return static_cast<int>(k.find_byte(data, length, static_cast<unsigned char>(value.int32)));
+		}
+	}
+}
+
+#undef as_int32
+#undef as_int64
+#undef as_float64
+
+std::string Array::toString() const
+{
+	const unsigned int shown = 32;
+	std::stringstream output;
+	output << elementTypeAsString(element_type) << "[";
+	for (unsigned int i=0; i<length && i<shown; ++i)
+	{
+		if (i>0) output << " ";
+		output << get(i).toString();
+	}
+	if (length > shown) output << " ...";
+	output << "]";
+	return output.str();
+}
@@ -0,0 +1,328 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include <cstring>
+
+#include "bytecode.hpp"
+#include "instructions.hpp"
+#include "verifier.hpp"
+
+BytecodeFormatError::BytecodeFormatError(std::string msg) : std::runtime_error(msg) {}
+
+
+/* disassembler */
+
+static void disassemble_range(const CodeBlock *block, unsigned int begin, unsigned int end, unsigned int depth, std::ostream &output)
+{
+	const Cell *text = block->cells();
+	unsigned int index = begin;
+	while (index < end)
+	{
+		const Cell &cell = text[index];
+		output << std::setw(5) << (index - begin) << "  " << std::string(depth * 2, ' ');
+
+		if (cell.type != INSTRUCTION)
+		{
+			/* procedure calls and word lookups */
+			output << cell.toString() << std::endl;
+			index += 1;
+			continue;
+		}
+
+		unsigned int width = instruction_width(block, index);
+		if (width == 0 || index + width > end)
+		{
+			output << instructionAsString(cell.opcode) << " <truncated>" << std::endl;
+			return;
+		}
+
+		const InstructionInfo &info = instruction_table[cell.opcode];
+		output << info.name;
+		for (unsigned int i=1; i<=info.immediates; ++i)
+		{
+			output << " " << text[index + i].toString();
+		}
+		if (info.flags & INSTRUCTION_BRANCH && text[index + 1].type == INT32)
+		{
+			output << " (-> " << (index - begin + 2 + text[index + 1].int32) << ")";
+		}
+		output << std::endl;
+
+		if (info.flags & INSTRUCTION_INLINE_BODY)
+		{
+			unsigned int body = index + 1 + info.immediates;
+			disassemble_range(block, body, index + width, depth + 1, output);
+		}
+		index += width;
+	}
+}
+
+std::string disassemble(const CodeBlock *block)
+{
+	std::stringstream output;
+	disassemble_range(block, 0, block->size, 0, output);
+	for (unsigned int i=0; i<block->handlers.size(); ++i)
+	{
+		const ExceptionHandler &handler = block->handlers[i];
+		output << "handler [" << handler.begin << ", " << handler.end << ") -> " << handler.target
+			<< " depth " << handler.depth << std::endl;
+	}
+	return output.str();
+}
+
+
+/* serializer; all integers are little endian */
+
+static const char IMAGE_MAGIC[4] = { 'O', 'O', 'P', 'B' };
+/* version 2 adds exception handler tables */
+static const unsigned int IMAGE_VERSION = 2;
+/* every serialized cell takes a type byte and at least a 4 byte payload */
+static const unsigned int MIN_CELL_BYTES = 5;
+/* what an image read from an unseekable stream may declare, in bytes */
+static const unsigned long long MAX_IMAGE_BYTES = 1ULL << 30;
+
+static void write_u8(std::ostream &output, unsigned int value)
+{
+	output.put(static_cast<char>(value & 0xff));
+}
+
+static void write_u32(std::ostream &output, unsigned int value)
+{
+	for (int i=0; i<4; ++i) write_u8(output, value >> (8 * i));
+}
+
+static void write_u64(std::ostream &output, unsigned long long value)
+{
+	for (int i=0; i<8; ++i) write_u8(output, static_cast<unsigned int>(value >> (8 * i)));
+}
+
+static void write_bytes(std::ostream &output, const char *data, unsigned int length)
+{
+	write_u32(output, length);
+	output.write(data, length);
+}
+
+static unsigned int read_u8(std::istream &input)
+{
+	int c = input.get();
+	if (c == EOF) throw BytecodeFormatError("Unexpected end of image");
+	return static_cast<unsigned int>(c);
+}
+
+static unsigned int read_u32(std::istream &input)
+{
+	unsigned int value = 0;
+	for (int i=0; i<4; ++i) value |= read_u8(input) << (8 * i);
+	return value;
+}
+
+static unsigned long long read_u64(std::istream &input)
+{
+	unsigned long long value = 0;
+	for (int i=0; i<8; ++i) value |= static_cast<unsigned long long>(read_u8(input)) << (8 * i);
+	return value;
+}
+
+static std::string read_bytes(std::istream &input)
+{
+	unsigned int length = read_u32(input);
+	std::string result;
+	/* the length is untrusted; the string only grows as bytes actually arrive */
+	result.reserve(std::min(length, 4096u));
+	for (unsigned int i=0; i<length; ++i) result.push_back(static_cast<char>(read_u8(input)));
+	return result;
+}
+
+/* bytes left in input, or MAX_IMAGE_BYTES when the stream cannot tell */
+static unsigned long long remaining_bytes(std::istream &input)
+{
+	std::streampos here = input.tellg();
+	if (here == std::streampos(-1)) return MAX_IMAGE_BYTES;
+	input.seekg(0, std::ios::end);
+	std::streampos end = input.tellg();
+	input.clear();
+	input.seekg(here);
+	if (end == std::streampos(-1) || end < here) return MAX_IMAGE_BYTES;
+	return static_cast<unsigned long long>(end - here);
+}
+
+/*
+	Numbers every procedure reachable from root; root is always 0. Blocks
+	compile_procedure has not resolved yet are read from their source, and
+	still name the words they call.
+*/
+static void collect_procedures(const CodeBlock *root, std::vector<const CodeBlock*> &blocks, std::map<const CodeBlock*, unsigned int> &numbers)
+{
+	numbers[root] = 0;
+	blocks.push_back(root);
+	for (unsigned int b=0; b<blocks.size(); ++b)
+	{
+		const CodeBlock *block = blocks[b];
+		const Cell *text = block->cells();
+		for (unsigned int i=0; i<block->size; ++i)
+		{
+			const Cell &cell = text[i];
+			if (cell.type != PROCEDURE || numbers.count(cell.procedure)) continue;
+			numbers[cell.procedure] = blocks.size();
+			blocks.push_back(cell.procedure);
+		}
+	}
+}
+
+void serialize_procedure(const CodeBlock *block, std::ostream &output)
+{
+	std::vector<const CodeBlock*> blocks;
+	std::map<const CodeBlock*, unsigned int> numbers;
+	collect_procedures(block, blocks, numbers);
+
+	output.write(IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+	write_u32(output, IMAGE_VERSION);
+	write_u32(output, OPCODE_COUNT);
+	write_u32(output, blocks.size());
+	for (unsigned int b=0; b<blocks.size(); ++b) write_u32(output, blocks[b]->size);
+
+	for (unsigned int b=0; b<blocks.size(); ++b)
+	{
+		const CodeBlock *current = blocks[b];
+		const Cell *text = current->cells();
+		for (unsigned int i=0; i<current->size; ++i)
+		{
+			const Cell &cell = text[i];
+			write_u8(output, cell.type);
+			switch (cell.type)
+			{
+				case INT32: write_u32(output, static_cast<unsigned int>(cell.int32)); break;
+				case INT64: write_u64(output, static_cast<unsigned long long>(cell.int64)); break;
+				case FLOAT64: {
+					unsigned long long bits;
+					memcpy(&bits, &cell.float64, sizeof(bits));
+					write_u64(output, bits);
+					break;
+				}
+				case INSTRUCTION: write_u32(output, cell.opcode); break;
+				case ZSTRING: write_bytes(output, cell.string, strlen(cell.string)); break;
+				case STRING: write_bytes(output, cell.str->data(), cell.str->length); break;
+				case PROCEDURE: write_u32(output, numbers[cell.procedure]); break;
+				default:
+					throw NotImplementedError("Cannot serialize " + Cell::typeAsString(cell.type));
+			}
+		}
+
+		write_u32(output, current->handlers.size());
+		for (unsigned int h=0; h<current->handlers.size(); ++h)
+		{
+			const ExceptionHandler &handler = current->handlers[h];
+			write_u32(output, handler.begin);
+			write_u32(output, handler.end);
+			write_u32(output, handler.target);
+			write_u32(output, static_cast<unsigned int>(handler.depth));
+		}
+	}
+}
+
+CodeBlock* deserialize_procedure(RuntimeMachine *meta, std::istream &input)
+{
+	char magic[sizeof(IMAGE_MAGIC)];
+	for (unsigned int i=0; i<sizeof(magic); ++i) magic[i] = static_cast<char>(read_u8(input));
+	if (memcmp(magic, IMAGE_MAGIC, sizeof(magic)) != 0) throw BytecodeFormatError("Not a bytecode image");
+	unsigned int version = read_u32(input);
+	if (version == 0 || version > IMAGE_VERSION) throw BytecodeFormatError("Unsupported image version");
+
+	/* older images use a prefix of the current opcode numbering */
+	unsigned int opcode_count = read_u32(input);
+	if (opcode_count > OPCODE_COUNT) throw BytecodeFormatError("Image uses unknown opcodes");
+
+	unsigned int block_count = read_u32(input);
+	if (block_count == 0) throw BytecodeFormatError("Image holds no procedure");
+
+	/* sizes are checked against what the image can still hold before anything is allocated */
+	unsigned long long remaining = remaining_bytes(input);
+	if (block_count > remaining / 4) throw BytecodeFormatError("Image declares more procedures than it holds");
+	remaining -= 4ULL * block_count;
+
+	std::vector<unsigned int> sizes;
+	sizes.reserve(block_count);
+	unsigned long long cell_count = 0;
+	for (unsigned int b=0; b<block_count; ++b)
+	{
+		sizes.push_back(read_u32(input));
+		cell_count += sizes.back();
+	}
+	if (cell_count > remaining / MIN_CELL_BYTES) throw BytecodeFormatError("Image declares more cells than it holds");
+
+	std::vector<CodeBlock*> blocks;
+	for (unsigned int b=0; b<block_count; ++b)
+	{
+		blocks.push_back(meta->create_anonymous_procedure(sizes[b]));
+	}
+
+	for (unsigned int b=0; b<block_count; ++b)
+	{
+		CodeBlock *current = blocks[b];
+		for (unsigned int i=0; i<current->size; ++i)
+		{
+			Cell &cell = current->text[i];
+			unsigned int type = read_u8(input);
+			switch (type)
+			{
+				case INT32: cell = Cell(static_cast<int>(read_u32(input))); break;
+				case INT64: cell = Cell(static_cast<long long>(read_u64(input))); break;
+				case FLOAT64: {
+					unsigned long long bits = read_u64(input);
+					double value;
+					memcpy(&value, &bits, sizeof(value));
+					cell = Cell(value);
+					break;
+				}
+				case INSTRUCTION: {
+					unsigned int opcode = read_u32(input);
+					if (opcode >= opcode_count) throw BytecodeFormatError("Invalid opcode");
+					cell = Cell(static_cast<Opcode>(opcode));
+					break;
+				}
+				case ZSTRING: {
+					std::string text = read_bytes(input);
+					if (text.find('\0') != std::string::npos) throw BytecodeFormatError("Word name holds a NUL");
+					cell = Cell(meta->create_string(text.c_str()));
+					break;
+				}
+				case STRING: {
+					std::string text = read_bytes(input);
+					cell = Cell(meta->create_managed_string(text.data(), text.size()));
+					break;
+				}
+				case PROCEDURE: {
+					unsigned int number = read_u32(input);
+					if (number >= block_count) throw BytecodeFormatError("Invalid procedure reference");
+					cell = Cell(blocks[number]);
+					break;
+				}
+				default:
+					throw BytecodeFormatError("Invalid cell type");
+			}
+		}
+
+		unsigned int handler_count = version >= 2 ? read_u32(input) : 0;
+		for (unsigned int h=0; h<handler_count; ++h)
+		{
+			ExceptionHandler handler;
+			handler.begin = read_u32(input);
+			handler.end = read_u32(input);
+			handler.target = read_u32(input);
+			handler.depth = static_cast<int>(read_u32(input));
+			if (handler.begin >= handler.end || handler.end > current->size || handler.target >= current->size || handler.depth < 0)
+			{
+				throw BytecodeFormatError("Invalid exception handler");
+			}
+			current->add_handler(handler);
+		}
+	}
+
+	/* loaded code is verified once, here, rather than checked on every step */
+	for (unsigned int b=0; b<block_count; ++b) verify_procedure(blocks[b]);
+	return blocks[0];
+}
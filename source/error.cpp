@@ -0,0 +1,48 @@
+#include "interpreter.hpp"
+
+#include <string>
+
+
+Error::Error(ErrorKind k, Cell v, std::exception_ptr c) : kind(k), value(v), cause(c) {}
+
+std::string Error::message() const
+{
+	if (cause)
+	{
+		try
+		{
+			std::rethrow_exception(cause);
+		}
+		catch (const std::exception &e)
+		{
+			return std::string(e.what());
+		}
+		catch (...)
+		{
+			return kindAsString(kind);
+		}
+	}
+	return value.toString();
+}
+
+std::string Error::toString() const
+{
+	return "error(" + kindAsString(kind) + ": " + message() + ")";
+}
+
+std::string Error::kindAsString(ErrorKind k)
+{
+	switch (k)
+	{
+		case ERROR_TYPE: return std::string("type_error");
+		case ERROR_KEY_NOT_FOUND: return std::string("key_not_found");
+		case ERROR_OUT_OF_BOUNDS: return std::string("out_of_bounds");
+		case ERROR_UNKNOWN_FUNCTION: return std::string("unknown_function");
+		case ERROR_NOT_IMPLEMENTED: return std::string("not_implemented");
+		case ERROR_ARITHMETIC: return std::string("arithmetic_error");
+		case ERROR_IO: return std::string("io_error");
+		case ERROR_HEAP_LIMIT: return std::string("heap_limit");
+		case ERROR_RAISED:
+		default: return std::string("raised");
+	}
+}
@@ -1,8 +1,15 @@
 #include "instructions.hpp"
+#include "verifier.hpp"
 #include "interpreter.hpp"
 
 #include <iostream>
 #include <iomanip>
+#include <climits>
+#include <limits>
+#include <cmath>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
 
 /* core instructions */
 void load_immediate(RuntimeMachine *meta)
@@ -16,31 +23,593 @@ void create_empty_object(RuntimeMachine *meta)
 	Object* obj = meta->create_object();
 	meta->push_argument(Cell(obj));
 }
-void add_int32(RuntimeMachine *meta)
+
+/* stack manipulation */
+void duplicate(RuntimeMachine *meta)
+{
+	Cell value = meta->pop_argument();
+	meta->push_argument(value);
+	meta->push_argument(value);
+}
+
+void drop(RuntimeMachine *meta)
+{
+	meta->pop_argument();
+}
+
+void swap(RuntimeMachine *meta)
+{
+	Cell top = meta->pop_argument();
+	Cell below = meta->pop_argument();
+	meta->push_argument(top);
+	meta->push_argument(below);
+}
+
+void over(RuntimeMachine *meta)
+{
+	Cell top = meta->pop_argument();
+	Cell below = meta->pop_argument();
+	meta->push_argument(below);
+	meta->push_argument(top);
+	meta->push_argument(below);
+}
+
+/* checked arithmetic shared by the typed and generic instructions */
+static void arithmetic_overflow(const char *name)
+{
+	throw ArithmeticError(std::string("Integer overflow in ") + name);
+}
+
+static void divide_by_zero(const char *name)
+{
+	throw ArithmeticError(std::string("Division by zero in ") + name);
+}
+
+template <typename T>
+static T checked_add(T lhs, T rhs, const char *name)
+{
+	T result;
+	if (__builtin_add_overflow(lhs, rhs, &result)) arithmetic_overflow(name);
+	return result;
+}
+
+template <typename T>
+static T checked_subtract(T lhs, T rhs, const char *name)
+{
+	T result;
+	if (__builtin_sub_overflow(lhs, rhs, &result)) arithmetic_overflow(name);
+	return result;
+}
+
+template <typename T>
+static T checked_multiply(T lhs, T rhs, const char *name)
+{
+	T result;
+	if (__builtin_mul_overflow(lhs, rhs, &result)) arithmetic_overflow(name);
+	return result;
+}
+
+template <typename T>
+static T checked_divide(T lhs, T rhs, const char *name)
+{
+	if (rhs == 0) divide_by_zero(name);
+	if (rhs == -1 && lhs == std::numeric_limits<T>::min()) arithmetic_overflow(name);
+	return lhs / rhs;
+}
+
+template <typename T>
+static T checked_modulo(T lhs, T rhs, const char *name)
+{
+	if (rhs == 0) divide_by_zero(name);
+	/* MIN % -1 traps on x86 even though the result is representable */
+	if (rhs == -1) return 0;
+	return lhs % rhs;
+}
+
+template <typename T>
+static T checked_negate(T value, const char *name)
+{
+	if (value == std::numeric_limits<T>::min()) arithmetic_overflow(name);
+	return -value;
+}
+
+/* floating point follows IEEE 754: no traps, division by zero gives an infinity */
+static double checked_add(double lhs, double rhs, const char*) { return lhs + rhs; }
+static double checked_subtract(double lhs, double rhs, const char*) { return lhs - rhs; }
+static double checked_multiply(double lhs, double rhs, const char*) { return lhs * rhs; }
+static double checked_divide(double lhs, double rhs, const char*) { return lhs / rhs; }
+static double checked_modulo(double lhs, double rhs, const char*) { return std::fmod(lhs, rhs); }
+static double checked_negate(double value, const char*) { return -value; }
+
+/* rhand is on top of the stack, lhand directly below it */
+#define define_typed_binary(name, celltype, member, op) \
+void name(RuntimeMachine *meta) \
+{ \
+	Cell rhand = meta->pop_argument(); \
+	rhand.assert_type(celltype, #name ".rhand"); \
+	Cell lhand = meta->pop_argument(); \
+	lhand.assert_type(celltype, #name ".lhand"); \
+	meta->push_argument( Cell(op(lhand.member, rhand.member, #name)) ); \
+}
+
+#define define_typed_comparison(name, celltype, member, op) \
+void name(RuntimeMachine *meta) \
+{ \
+	Cell rhand = meta->pop_argument(); \
+	rhand.assert_type(celltype, #name ".rhand"); \
+	Cell lhand = meta->pop_argument(); \
+	lhand.assert_type(celltype, #name ".lhand"); \
+	meta->push_argument( Cell(lhand.member op rhand.member ? 1 : 0) ); \
+}
+
+#define define_typed_negate(name, celltype, member) \
+void name(RuntimeMachine *meta) \
+{ \
+	Cell value = meta->pop_argument(); \
+	value.assert_type(celltype, #name ".value"); \
+	meta->push_argument( Cell(checked_negate(value.member, #name)) ); \
+}
+
+define_typed_binary(add_int32, INT32, int32, checked_add)
+define_typed_binary(subtract_int32, INT32, int32, checked_subtract)
+define_typed_binary(multiply_int32, INT32, int32, checked_multiply)
+define_typed_binary(divide_int32, INT32, int32, checked_divide)
+define_typed_binary(modulo_int32, INT32, int32, checked_modulo)
+define_typed_negate(negate_int32, INT32, int32)
+define_typed_comparison(equal_int32, INT32, int32, ==)
+define_typed_comparison(not_equal_int32, INT32, int32, !=)
+define_typed_comparison(less_int32, INT32, int32, <)
+define_typed_comparison(less_equal_int32, INT32, int32, <=)
+define_typed_comparison(greater_int32, INT32, int32, >)
+define_typed_comparison(greater_equal_int32, INT32, int32, >=)
+
+define_typed_binary(add_int64, INT64, int64, checked_add)
+define_typed_binary(subtract_int64, INT64, int64, checked_subtract)
+define_typed_binary(multiply_int64, INT64, int64, checked_multiply)
+define_typed_binary(divide_int64, INT64, int64, checked_divide)
+define_typed_binary(modulo_int64, INT64, int64, checked_modulo)
+define_typed_negate(negate_int64, INT64, int64)
+define_typed_comparison(equal_int64, INT64, int64, ==)
+define_typed_comparison(not_equal_int64, INT64, int64, !=)
+define_typed_comparison(less_int64, INT64, int64, <)
+define_typed_comparison(less_equal_int64, INT64, int64, <=)
+define_typed_comparison(greater_int64, INT64, int64, >)
+define_typed_comparison(greater_equal_int64, INT64, int64, >=)
+
+define_typed_binary(add_float64, FLOAT64, float64, checked_add)
+define_typed_binary(subtract_float64, FLOAT64, float64, checked_subtract)
+define_typed_binary(multiply_float64, FLOAT64, float64, checked_multiply)
+define_typed_binary(divide_float64, FLOAT64, float64, checked_divide)
+define_typed_negate(negate_float64, FLOAT64, float64)
+define_typed_comparison(equal_float64, FLOAT64, float64, ==)
+define_typed_comparison(not_equal_float64, FLOAT64, float64, !=)
+define_typed_comparison(less_float64, FLOAT64, float64, <)
+define_typed_comparison(less_equal_float64, FLOAT64, float64, <=)
+define_typed_comparison(greater_float64, FLOAT64, float64, >)
+define_typed_comparison(greater_equal_float64, FLOAT64, float64, >=)
+
+#undef define_typed_binary
+#undef define_typed_comparison
+#undef define_typed_negate
+
+/* generic numeric instructions: promote int32 < int64 < float64 */
+static bool is_numeric(CellType t)
+{
+	return t == INT32 || t == INT64 || t == FLOAT64;
+}
+
+static CellType promoted_type(const Cell &lhand, const Cell &rhand, const char *name)
+{
+	const Cell &bad = is_numeric(lhand.type) ? rhand : lhand;
+	if (!is_numeric(bad.type))
+	{
+		std::stringstream output;
+		output << "Illegal operand type from " << name << " - expected " <<
+			Cell::typeAsString(INT32) << ", " <<
+			Cell::typeAsString(INT64) << " or " <<
+			Cell::typeAsString(FLOAT64) <<
+			" but received " << Cell::typeAsString(bad.type);
+		throw CellTypeException(output.str());
+	}
+	if (lhand.type == FLOAT64 || rhand.type == FLOAT64) return FLOAT64;
+	if (lhand.type == INT64 || rhand.type == INT64) return INT64;
+	return INT32;
+}
+
+static long long as_int64(const Cell &c)
+{
+	return c.type == INT32 ? static_cast<long long>(c.int32) : c.int64;
+}
+
+static double as_float64(const Cell &c)
+{
+	switch (c.type)
+	{
+		case INT32: return static_cast<double>(c.int32);
+		case INT64: return static_cast<double>(c.int64);
+		default: return c.float64;
+	}
+}
+
+/* operands of the same type skip promotion entirely */
+#define define_numeric_binary(name, op) \
+void name(RuntimeMachine *meta) \
+{ \
+	Cell rhand = meta->pop_argument(); \
+	Cell lhand = meta->pop_argument(); \
+	if (lhand.type == rhand.type) \
+	{ \
+		switch (lhand.type) \
+		{ \
+			case INT32: meta->push_argument( Cell(op(lhand.int32, rhand.int32, #name)) ); return; \
+			case INT64: meta->push_argument( Cell(op(lhand.int64, rhand.int64, #name)) ); return; \
+			case FLOAT64: meta->push_argument( Cell(op(lhand.float64, rhand.float64, #name)) ); return; \
+			default: break; \
+		} \
+	} \
+	if (promoted_type(lhand, rhand, #name) == INT64) \
+		meta->push_argument( Cell(op(as_int64(lhand), as_int64(rhand), #name)) ); \
+	else \
+		meta->push_argument( Cell(op(as_float64(lhand), as_float64(rhand), #name)) ); \
+}
+
+#define define_numeric_comparison(name, op) \
+void name(RuntimeMachine *meta) \
+{ \
+	Cell rhand = meta->pop_argument(); \
+	Cell lhand = meta->pop_argument(); \
+	bool result; \
+	if (lhand.type == rhand.type && lhand.type == INT32) result = lhand.int32 op rhand.int32; \
+	else if (promoted_type(lhand, rhand, #name) != FLOAT64) result = as_int64(lhand) op as_int64(rhand); \
+	else result = as_float64(lhand) op as_float64(rhand); \
+	meta->push_argument( Cell(result ? 1 : 0) ); \
+}
+
+define_numeric_binary(add_number, checked_add)
+define_numeric_binary(subtract_number, checked_subtract)
+define_numeric_binary(multiply_number, checked_multiply)
+define_numeric_binary(divide_number, checked_divide)
+define_numeric_binary(modulo_number, checked_modulo)
+define_numeric_comparison(equal_number, ==)
+define_numeric_comparison(less_number, <)
+
+#undef define_numeric_binary
+#undef define_numeric_comparison
+
+void negate_number(RuntimeMachine *meta)
+{
+	Cell value = meta->pop_argument();
+	switch (value.type)
+	{
+		case INT32: meta->push_argument( Cell(checked_negate(value.int32, "negate_number")) ); break;
+		case INT64: meta->push_argument( Cell(checked_negate(value.int64, "negate_number")) ); break;
+		case FLOAT64: meta->push_argument( Cell(checked_negate(value.float64, "negate_number")) ); break;
+		default: promoted_type(value, value, "negate_number"); break;
+	}
+}
+
+/* conversions */
+void convert_to_int32(RuntimeMachine *meta)
+{
+	Cell value = meta->pop_argument();
+	promoted_type(value, value, "convert_to_int32");
+	if (value.type == FLOAT64)
+	{
+		/* NaN fails both comparisons */
+		if (!(value.float64 >= INT_MIN && value.float64 < 2147483648.0)) arithmetic_overflow("convert_to_int32");
+		meta->push_argument( Cell(static_cast<int>(value.float64)) );
+	}
+	else
+	{
+		long long i = as_int64(value);
+		if (i < INT_MIN || i > INT_MAX) arithmetic_overflow("convert_to_int32");
+		meta->push_argument( Cell(static_cast<int>(i)) );
+	}
+}
+
+void convert_to_int64(RuntimeMachine *meta)
+{
+	Cell value = meta->pop_argument();
+	promoted_type(value, value, "convert_to_int64");
+	if (value.type == FLOAT64)
+	{
+		if (!(value.float64 >= -9223372036854775808.0 && value.float64 < 9223372036854775808.0)) arithmetic_overflow("convert_to_int64");
+		meta->push_argument( Cell(static_cast<long long>(value.float64)) );
+	}
+	else
+	{
+		meta->push_argument( Cell(as_int64(value)) );
+	}
+}
+
+void convert_to_float64(RuntimeMachine *meta)
+{
+	Cell value = meta->pop_argument();
+	promoted_type(value, value, "convert_to_float64");
+	meta->push_argument( Cell(as_float64(value)) );
+}
+
+/* arrays */
+void create_array(RuntimeMachine *meta)
+{
+	Cell type_cell = meta->pop_argument();
+	type_cell.assert_type(INT32, "create_array.element_type");
+	Cell length_cell = meta->pop_argument();
+	length_cell.assert_type(INT32, "create_array.length");
+
+	if (type_cell.int32 < ELEMENT_INT32 || type_cell.int32 > ELEMENT_BYTE)
+	{
+		throw CellTypeException(std::string("create_array - unknown element type ") + type_cell.toString());
+	}
+	if (length_cell.int32 < 0)
+	{
+		throw ExecutionOutOfBoundsError(std::string("create_array - negative length ") + length_cell.toString());
+	}
+	Array *arr = meta->create_array(static_cast<ElementType>(type_cell.int32), static_cast<unsigned int>(length_cell.int32));
+	meta->push_argument(Cell(arr));
+}
+
+void array_length(RuntimeMachine *meta)
+{
+	Cell arr_cell = meta->pop_argument();
+	arr_cell.assert_type(ARRAY, "array_length.array");
+	meta->push_argument( Cell(static_cast<int>(arr_cell.array->length)) );
+}
+
+void array_get(RuntimeMachine *meta)
+{
+	Cell arr_cell = meta->pop_argument();
+	arr_cell.assert_type(ARRAY, "array_get.array");
+	Cell index_cell = meta->pop_argument();
+	index_cell.assert_type(INT32, "array_get.index");
+
+	/* negative indices wrap to huge unsigned values and fail the bounds check */
+	meta->push_argument( arr_cell.array->get(static_cast<unsigned int>(index_cell.int32)) );
+}
+
+void array_set(RuntimeMachine *meta)
+{
+	Cell arr_cell = meta->pop_argument();
+	arr_cell.assert_type(ARRAY, "array_set.array");
+	Cell index_cell = meta->pop_argument();
+	index_cell.assert_type(INT32, "array_set.index");
+	Cell value_cell = meta->pop_argument();
+
+	arr_cell.array->set(static_cast<unsigned int>(index_cell.int32), value_cell);
+	meta->push_argument(arr_cell);
+}
+
+void array_slice(RuntimeMachine *meta)
+{
+	Cell arr_cell = meta->pop_argument();
+	arr_cell.assert_type(ARRAY, "array_slice.array");
+	Cell end_cell = meta->pop_argument();
+	end_cell.assert_type(INT32, "array_slice.end");
+	Cell start_cell = meta->pop_argument();
+	start_cell.assert_type(INT32, "array_slice.start");
+
+	Array *arr = arr_cell.array;
+	if (start_cell.int32 < 0 || end_cell.int32 < start_cell.int32 || static_cast<unsigned int>(end_cell.int32) > arr->length)
+	{
+		std::stringstream output;
+		output << "array_slice - range [" << start_cell.int32 << ", " << end_cell.int32 << ") out of bounds for length " << arr->length;
+		throw ExecutionOutOfBoundsError(output.str());
+	}
+	unsigned int start = static_cast<unsigned int>(start_cell.int32);
+	unsigned int length = static_cast<unsigned int>(end_cell.int32) - start;
+	meta->push_argument( Cell(meta->create_array_slice(arr, start, length)) );
+}
+
+void array_add(RuntimeMachine *meta)
 {
+	Cell rhand = meta->pop_argument();
+	rhand.assert_type(ARRAY, "array_add.rhand");
 	Cell lhand = meta->pop_argument();
-	lhand.assert_type(INT32, "add_int32.lhand");
+	lhand.assert_type(ARRAY, "array_add.lhand");
+
+	Array *result = meta->create_array(lhand.array->element_type, lhand.array->length);
+	result->add(lhand.array, rhand.array);
+	meta->push_argument(Cell(result));
+}
 
+void array_multiply(RuntimeMachine *meta)
+{
 	Cell rhand = meta->pop_argument();
-	lhand.assert_type(INT32, "add_int32.rhand");
+	rhand.assert_type(ARRAY, "array_multiply.rhand");
+	Cell lhand = meta->pop_argument();
+	lhand.assert_type(ARRAY, "array_multiply.lhand");
+
+	Array *result = meta->create_array(lhand.array->element_type, lhand.array->length);
+	result->multiply(lhand.array, rhand.array);
+	meta->push_argument(Cell(result));
+}
+
+void array_sum(RuntimeMachine *meta)
+{
+	Cell arr_cell = meta->pop_argument();
+	arr_cell.assert_type(ARRAY, "array_sum.array");
+	meta->push_argument(arr_cell.array->sum());
+}
 
-	int i = lhand.int32 + rhand.int32;
-	meta->push_argument( Cell(i) );
+void array_min(RuntimeMachine *meta)
+{
+	Cell arr_cell = meta->pop_argument();
+	arr_cell.assert_type(ARRAY, "array_min.array");
+	meta->push_argument(arr_cell.array->min());
+}
+
+void array_max(RuntimeMachine *meta)
+{
+	Cell arr_cell = meta->pop_argument();
+	arr_cell.assert_type(ARRAY, "array_max.array");
+	meta->push_argument(arr_cell.array->max());
+}
+
+void array_fill(RuntimeMachine *meta)
+{
+	Cell arr_cell = meta->pop_argument();
+	arr_cell.assert_type(ARRAY, "array_fill.array");
+	Cell value_cell = meta->pop_argument();
+	arr_cell.array->fill(value_cell);
+	meta->push_argument(arr_cell);
+}
+
+void array_copy(RuntimeMachine *meta)
+{
+	Cell dest_cell = meta->pop_argument();
+	dest_cell.assert_type(ARRAY, "array_copy.destination");
+	Cell source_cell = meta->pop_argument();
+	source_cell.assert_type(ARRAY, "array_copy.source");
+	dest_cell.array->copy_from(source_cell.array);
+	meta->push_argument(dest_cell);
+}
+
+void array_find(RuntimeMachine *meta)
+{
+	Cell arr_cell = meta->pop_argument();
+	arr_cell.assert_type(ARRAY, "array_find.array");
+	Cell value_cell = meta->pop_argument();
+	meta->push_argument( Cell(arr_cell.array->find(value_cell)) );
 }
 
+/* managed strings */
+void make_string(RuntimeMachine *meta)
+{
+	Cell source = meta->pop_argument();
+	source.assert_type(ZSTRING, "make_string.source");
+	String *result = meta->create_managed_string(source.string, strlen(source.string));
+	meta->push_argument(Cell(result));
+}
+
+void string_length(RuntimeMachine *meta)
+{
+	Cell str_cell = meta->pop_argument();
+	str_cell.assert_type(STRING, "string_length.string");
+	meta->push_argument( Cell(static_cast<int>(str_cell.str->length)) );
+}
+
+void string_concatenate(RuntimeMachine *meta)
+{
+	Cell rhand = meta->pop_argument();
+	rhand.assert_type(STRING, "string_concatenate.rhand");
+	Cell lhand = meta->pop_argument();
+	lhand.assert_type(STRING, "string_concatenate.lhand");
+	meta->push_argument( Cell(meta->create_string_concatenation(lhand.str, rhand.str)) );
+}
+
+void string_slice(RuntimeMachine *meta)
+{
+	Cell str_cell = meta->pop_argument();
+	str_cell.assert_type(STRING, "string_slice.string");
+	Cell end_cell = meta->pop_argument();
+	end_cell.assert_type(INT32, "string_slice.end");
+	Cell start_cell = meta->pop_argument();
+	start_cell.assert_type(INT32, "string_slice.start");
+
+	String *str = str_cell.str;
+	if (start_cell.int32 < 0 || end_cell.int32 < start_cell.int32 || static_cast<unsigned int>(end_cell.int32) > str->length)
+	{
+		std::stringstream output;
+		output << "string_slice - range [" << start_cell.int32 << ", " << end_cell.int32 << ") out of bounds for length " << str->length;
+		throw ExecutionOutOfBoundsError(output.str());
+	}
+	unsigned int start = static_cast<unsigned int>(start_cell.int32);
+	unsigned int length = static_cast<unsigned int>(end_cell.int32) - start;
+	meta->push_argument( Cell(meta->create_string_slice(str, start, length)) );
+}
+
+void string_find(RuntimeMachine *meta)
+{
+	Cell needle = meta->pop_argument();
+	needle.assert_type(STRING, "string_find.needle");
+	Cell haystack = meta->pop_argument();
+	haystack.assert_type(STRING, "string_find.haystack");
+	meta->push_argument( Cell(haystack.str->find(needle.str)) );
+}
+
+void string_compare(RuntimeMachine *meta)
+{
+	Cell rhand = meta->pop_argument();
+	rhand.assert_type(STRING, "string_compare.rhand");
+	Cell lhand = meta->pop_argument();
+	lhand.assert_type(STRING, "string_compare.lhand");
+	meta->push_argument( Cell(lhand.str->compare(rhand.str)) );
+}
+
+void string_equal(RuntimeMachine *meta)
+{
+	Cell rhand = meta->pop_argument();
+	rhand.assert_type(STRING, "string_equal.rhand");
+	Cell lhand = meta->pop_argument();
+	lhand.assert_type(STRING, "string_equal.lhand");
+	meta->push_argument( Cell(lhand.str->equals(rhand.str) ? 1 : 0) );
+}
+
+void string_hash(RuntimeMachine *meta)
+{
+	Cell str_cell = meta->pop_argument();
+	str_cell.assert_type(STRING, "string_hash.string");
+	meta->push_argument( Cell(static_cast<int>(str_cell.str->hash())) );
+}
+
+/* control flow */
+void jump_relative(RuntimeMachine *meta)
+{
+	Cell offset = meta->read_byte();
+	offset.assert_type(INT32, "jump_relative.offset");
+	meta->jump_relative(offset.int32);
+}
+
+void jump_if_zero(RuntimeMachine *meta)
+{
+	Cell offset = meta->read_byte();
+	offset.assert_type(INT32, "jump_if_zero.offset");
+	Cell condition = meta->pop_argument();
+	condition.assert_type(INT32, "jump_if_zero.condition");
+	if (condition.int32 == 0) meta->jump_relative(offset.int32);
+}
+
+void jump_if_nonzero(RuntimeMachine *meta)
+{
+	Cell offset = meta->read_byte();
+	offset.assert_type(INT32, "jump_if_nonzero.offset");
+	Cell condition = meta->pop_argument();
+	condition.assert_type(INT32, "jump_if_nonzero.condition");
+	if (condition.int32 != 0) meta->jump_relative(offset.int32);
+}
+
+/*
+	Only records where the body is; RuntimeMachine::resolve_procedure finishes
+	it on the first call. The collector keeps a managed block alive for as
+	long as the procedure points into it, but the host may free or reuse its
+	own blocks as soon as they have run, so a body compiled from one of
+	those is copied out first.
+*/
 void compile_procedure(RuntimeMachine *meta)
 {
 	Cell size_byte = meta->read_byte();
 	size_byte.assert_type(INT32, "load_anonymous_procedure.size");
 
+	StackFrame &frame = meta->current_stack_frame();
 	unsigned int size = static_cast<unsigned int>(size_byte.int32);
+	if (size_byte.int32 < 0 || size > static_cast<unsigned int>(frame.end() - frame.current()))
+	{
+		throw ExecutionOutOfBoundsError(std::string("Read past code bounds"));
+	}
 
 	CodeBlock *dest = meta->create_anonymous_procedure(size);
-
-	for (unsigned int i=0; i<size; ++i)
+	if (meta->is_managed(Cell(const_cast<CodeBlock*>(frame.code))))
+	{
+		dest->source = frame.code;
+		dest->source_offset = frame.current() - frame.begin();
+	}
+	else
 	{
-		meta->compile_next_instruction(dest, i);
+		CodeBlock *body = meta->create_anonymous_procedure(size);
+		std::copy(frame.current(), frame.current() + size, body->text);
+		dest->source = body;
 	}
+	frame.location_pointer += size;
 	meta->push_argument(Cell(dest));
 }
 
@@ -99,18 +668,116 @@ void get_object_attribute(RuntimeMachine *meta)
 }
 
 
-std::string instructionAsString(Instruction inst)
+/* exceptions */
+void install_handler(RuntimeMachine *meta)
+{
+	Cell code_cell = meta->pop_argument();
+	code_cell.assert_type(PROCEDURE, "install_handler.procedure");
+	Cell depth_cell = meta->pop_argument();
+	depth_cell.assert_type(INT32, "install_handler.depth");
+	Cell target_cell = meta->pop_argument();
+	target_cell.assert_type(INT32, "install_handler.target");
+	Cell end_cell = meta->pop_argument();
+	end_cell.assert_type(INT32, "install_handler.end");
+	Cell begin_cell = meta->pop_argument();
+	begin_cell.assert_type(INT32, "install_handler.begin");
+
+	if (begin_cell.int32 < 0 || end_cell.int32 < 0 || target_cell.int32 < 0)
+	{
+		throw ExecutionOutOfBoundsError("install_handler - negative code index");
+	}
+
+	ExceptionHandler handler;
+	handler.begin = static_cast<unsigned int>(begin_cell.int32);
+	handler.end = static_cast<unsigned int>(end_cell.int32);
+	handler.target = static_cast<unsigned int>(target_cell.int32);
+	handler.depth = depth_cell.int32;
+	if (meta->is_running(code_cell.procedure))
+	{
+		throw ExecutionOutOfBoundsError("install_handler - procedure is running");
+	}
+	code_cell.procedure->add_handler(handler);
+
+	meta->push_argument(code_cell);
+}
+
+void raise_error(RuntimeMachine *meta)
+{
+	Cell value = meta->pop_argument();
+	/* re-raising a caught error keeps its kind and cause */
+	Error *error = value.type == ERROR ? value.error : meta->create_error(ERROR_RAISED, value, std::exception_ptr());
+	meta->raise_error(error);
+}
+
+void error_kind(RuntimeMachine *meta)
+{
+	Cell error_cell = meta->pop_argument();
+	error_cell.assert_type(ERROR, "error_kind.error");
+	meta->push_argument( Cell(static_cast<int>(error_cell.error->kind)) );
+}
+
+void error_value(RuntimeMachine *meta)
+{
+	Cell error_cell = meta->pop_argument();
+	error_cell.assert_type(ERROR, "error_value.error");
+	meta->push_argument(error_cell.error->value);
+}
+
+void error_message(RuntimeMachine *meta)
+{
+	Cell error_cell = meta->pop_argument();
+	error_cell.assert_type(ERROR, "error_message.error");
+	std::string message = error_cell.error->message();
+	meta->push_argument( Cell(meta->create_managed_string(message.data(), message.size())) );
+}
+
+void call_host_function(RuntimeMachine *meta)
+{
+	Cell index_cell = meta->read_byte();
+	index_cell.assert_type(INT32, "call_host_function.index");
+	if (index_cell.int32 < 0) throw UnknownFunctionError("call_host_function - negative index");
+	meta->call_host_function(static_cast<unsigned int>(index_cell.int32));
+}
+
+
+const InstructionInfo instruction_table[OPCODE_COUNT] = {
+	#define OPCODE(name, immediates, pops, pushes, can_throw, flags, signature) \
+		{ #name, name, immediates, pops, pushes, can_throw, flags, signature },
+	#include "opcodes.def"
+	#undef OPCODE
+};
+
+Opcode opcode_of(Instruction inst)
+{
+	for (unsigned int i=0; i<OPCODE_COUNT; ++i)
+	{
+		if (instruction_table[i].function == inst) return static_cast<Opcode>(i);
+	}
+	throw UnknownFunctionError("Instruction is not registered");
+}
+
+unsigned int instruction_width(const CodeBlock *block, unsigned int index)
+{
+	const Cell *text = block->cells();
+	const Cell &cell = text[index];
+	if (cell.type != INSTRUCTION) return 1;
+	if (cell.opcode >= OPCODE_COUNT) return 0;
+
+	const InstructionInfo &info = instruction_table[cell.opcode];
+	unsigned int width = 1 + info.immediates;
+	if (index + width > block->size) return 0;
+	if (info.flags & INSTRUCTION_INLINE_BODY)
+	{
+		const Cell &length = text[index + 1];
+		if (length.type != INT32 || length.int32 < 0) return 0;
+		if (static_cast<unsigned int>(length.int32) > block->size - index - width) return 0;
+		width += static_cast<unsigned int>(length.int32);
+	}
+	return width;
+}
+
+std::string instructionAsString(Opcode op)
 {
-	/* just don't worry about it */
-	#define if_instruction(x) if (inst == x) { return std::string(#x); }
-	if_instruction(add_int32)
-	else if_instruction(load_immediate)
-	else if_instruction(exit_program)
-	else if_instruction(compile_procedure)
-	else if_instruction(return_from_function)
-	else if_instruction(execute_stack_procedure)
-	else if_instruction(create_empty_object)
-	else if_instruction(set_object_attribute)
-	else return std::string("unknown_instruction");
-	#undef if_instruction
+	if (op >= OPCODE_COUNT) return std::string("unknown_instruction");
+	return std::string(instruction_table[op].name);
 }
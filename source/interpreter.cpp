@@ -5,30 +5,71 @@
 #include <stdexcept>
 #include <sstream>
 #include <list>
+#include <set>
+#include <fstream>
 
 #include <cstring>
 #include <cstdlib>
+#include <climits>
+#include <algorithm>
 
 #include "interpreter.hpp"
+#include "instructions.hpp"
+#include "verifier.hpp"
+#include "embedding.hpp"
+#ifdef OOPART_JIT
+#include "jit.hpp"
+#endif
 
 #ifndef NULL
 #define NULL ((void*)0)
 #endif
 
-extern std::string instructionAsString(Instruction i);
+CellTypeException::CellTypeException(std::string msg)
+: std::runtime_error(msg), expected(INT32), received(INT32), formatted(true) {}
+
+CellTypeException::CellTypeException(CellType exp, CellType rec, std::string ctx)
+: std::runtime_error("Illegal operand type"), context(ctx), expected(exp), received(rec), formatted(false) {}
+
+const char *CellTypeException::what() const noexcept
+{
+	if (formatted) return std::runtime_error::what();
+	if (message.empty())
+	{
+		try
+		{
+			message = "Illegal operand type from " + context + " - expected " +
+				Cell::typeAsString(expected) + " but received " + Cell::typeAsString(received);
+		}
+		catch (...)
+		{
+			return std::runtime_error::what();
+		}
+	}
+	return message.c_str();
+}
 
-CellTypeException::CellTypeException(std::string msg) : std::runtime_error(msg) {}
 ExecutionOutOfBoundsError::ExecutionOutOfBoundsError(std::string msg) : std::runtime_error(msg) {}
 UnknownFunctionError::UnknownFunctionError(std::string msg) : std::runtime_error(msg) {}
 NotImplementedError::NotImplementedError(std::string msg) : std::runtime_error(msg) {}
+ArithmeticError::ArithmeticError(std::string msg) : std::runtime_error(msg) {}
+IoError::IoError(std::string msg) : std::runtime_error(msg) {}
+HeapLimitError::HeapLimitError(std::string msg) : std::runtime_error(msg) {}
+UncaughtError::UncaughtError(std::string msg) : std::runtime_error(msg) {}
 
 Cell::Cell() : type(INT32) { int32 = 0; }
 Cell::Cell(int i) : type(INT32) { int32 = i; }
+Cell::Cell(long long i) : type(INT64) { int64 = i; }
+Cell::Cell(double d) : type(FLOAT64) { float64 = d; }
 Cell::Cell(Cell *other) : type(ADDRESS) { address = other; }
 Cell::Cell(char *s) : type(ZSTRING) { string = s; }
-Cell::Cell(Instruction inst) : type(INSTRUCTION) { instruction = inst; }
+Cell::Cell(Instruction inst) : type(INSTRUCTION) { opcode = opcode_of(inst); }
+Cell::Cell(Opcode op) : type(INSTRUCTION) { opcode = op; }
 Cell::Cell(CodeBlock *block) : type(PROCEDURE) { procedure = block; }
 Cell::Cell(Object *obj) : type(OBJECT) { object = obj; }
+Cell::Cell(Array *arr) : type(ARRAY) { array = arr; }
+Cell::Cell(String *s) : type(STRING) { str = s; }
+Cell::Cell(Error *e) : type(ERROR) { error = e; }
 
 Cell::Cell(const Cell &other)
 : type(other.type)
@@ -36,10 +77,15 @@ Cell::Cell(const Cell &other)
 	switch (other.type)
 	{
 		case INT32: int32 = other.int32; break;
-		case INSTRUCTION: instruction = other.instruction; break;
+		case INT64: int64 = other.int64; break;
+		case FLOAT64: float64 = other.float64; break;
+		case INSTRUCTION: opcode = other.opcode; break;
 		case ZSTRING: string = other.string; break;
 		case PROCEDURE: procedure = other.procedure; break;
 		case OBJECT: object = other.object; break;
+		case ARRAY: array = other.array; break;
+		case STRING: str = other.str; break;
+		case ERROR: error = other.error; break;
 		case ADDRESS: 
 		default: address = other.address; break;
 	}
@@ -50,10 +96,15 @@ std::string Cell::typeAsString(CellType t)
 	switch (t)
 	{
 		case INT32: return std::string("@integer");
+		case INT64: return std::string("@long");
+		case FLOAT64: return std::string("@double");
 		case INSTRUCTION: return std::string("@instruction");
 		case ZSTRING: return std::string("@string");
 		case PROCEDURE: return std::string("@procedure");
 		case OBJECT: return std::string("@object");
+		case ARRAY: return std::string("@array");
+		case STRING: return std::string("@text");
+		case ERROR: return std::string("@error");
 		case ADDRESS: 
 		default:  return std::string("@pointer");
 	}
@@ -68,6 +119,25 @@ std::string Cell::toString() const
 			output << "$" << int32;
 			break;
 		}
+		case INT64: {
+			output << "$" << int64 << "L";
+			break;
+		}
+		case FLOAT64: {
+			/* shortest precision that reads back as the same double */
+			std::string digits;
+			for (int precision=15; precision<=17; ++precision)
+			{
+				std::stringstream number;
+				number << std::setprecision(precision) << float64;
+				digits = number.str();
+				if (strtod(digits.c_str(), NULL) == float64) break;
+			}
+			/* keep doubles distinguishable from integers */
+			if (digits.find_first_of(".eni") == std::string::npos) digits += ".0";
+			output << "$" << digits;
+			break;
+		}
 		case ZSTRING: {
 			output << '"' << std::string(string) << '"';
 			break;
@@ -77,7 +147,7 @@ std::string Cell::toString() const
 			break;
 		}
 		case INSTRUCTION: {
-			output << "<" << instructionAsString(instruction) << ">";
+			output << "<" << instructionAsString(opcode) << ">";
 			break;
 		}
 		case PROCEDURE: {
@@ -88,6 +158,18 @@ std::string Cell::toString() const
 			output << object->toString();
 			break;
 		}
+		case ARRAY: {
+			output << array->toString();
+			break;
+		}
+		case STRING: {
+			output << '"' << str->toString() << '"';
+			break;
+		}
+		case ERROR: {
+			output << error->toString();
+			break;
+		}
 		default: {
 			output << std::hex << (void*)address;
 			break;
@@ -96,17 +178,41 @@ std::string Cell::toString() const
 	return output.str();
 }
 
+/*
+	Cells are also keys (Object attributes, ordered containers), so floats
+	compare in a total order: every NaN equals every other and sorts after
+	all numbers. Bytecode comparisons keep IEEE semantics in their own
+	instructions.
+*/
+static bool float64_equal(double a, double b)
+{
+	if (a != a || b != b) return a != a && b != b;
+	return a == b;
+}
+
+static bool float64_less(double a, double b)
+{
+	if (a != a) return false;
+	if (b != b) return true;
+	return a < b;
+}
+
 bool Cell::operator==(const Cell &other) const
 {
 	if (type != other.type) return false;
 	switch (type)
 	{
 		case INT32: return this->int32 == other.int32;
+		case INT64: return this->int64 == other.int64;
+		case FLOAT64: return float64_equal(this->float64, other.float64);
 		case ZSTRING: return strcmp(this->string, other.string) == 0;
 		case ADDRESS: return this->address == other.address;
-		case INSTRUCTION: return this->instruction == other.instruction;
+		case INSTRUCTION: return this->opcode == other.opcode;
 		case PROCEDURE: return this->procedure == other.procedure;
 		case OBJECT: return this->object == other.object;
+		case ARRAY: return this->array == other.array;
+		case STRING: return this->str->equals(other.str);
+		case ERROR: return this->error == other.error;
 		default: return false;
 	}
 }
@@ -118,11 +224,16 @@ bool Cell::operator<(const Cell &other) const
 		switch (type)
 		{
 			case INT32: return this->int32 < other.int32;
+			case INT64: return this->int64 < other.int64;
+			case FLOAT64: return float64_less(this->float64, other.float64);
 			case ZSTRING: return strcmp(this->string, other.string) < 0;
 			case ADDRESS: return this->address < other.address;
-			case INSTRUCTION: return this->instruction < other.instruction;
+			case INSTRUCTION: return this->opcode < other.opcode;
 			case PROCEDURE: return this->procedure < other.procedure;
 			case OBJECT: return this->object < other.object;
+			case ARRAY: return this->array < other.array;
+			case STRING: return this->str->compare(other.str) < 0;
+			case ERROR: return this->error < other.error;
 			default: return false;
 		}
 	}
@@ -133,17 +244,13 @@ void Cell::assert_type(CellType t, std::string message)
 {
 	if (type != t)
 	{
-		std::string received = Cell::typeAsString(this->type);
-		std::string expected = Cell::typeAsString(t);
-		std::stringstream output;
-		output << "Illegal operand type from " << message << " - expected " << expected << " but received " << received;
-		throw CellTypeException(output.str());
+		throw CellTypeException(t, this->type, message);
 	}
 }
 
-StackFrame::StackFrame(const CodeBlock *cblock, Object *ctx, Cell *raddr) : code(cblock), context(ctx), location_pointer(raddr)  {}
+StackFrame::StackFrame(const CodeBlock *cblock, Object *ctx, Cell *raddr) : code(cblock), context(ctx), location_pointer(raddr), stack_base(0)  {}
 
-StackFrame::StackFrame(const StackFrame &other) : code(other.code), context(other.context), location_pointer(other.location_pointer)  {}
+StackFrame::StackFrame(const StackFrame &other) : code(other.code), context(other.context), location_pointer(other.location_pointer), stack_base(other.stack_base)  {}
 
 Cell *StackFrame::begin() const
 {
@@ -166,11 +273,56 @@ std::string StackFrame::toString() const
 }
 
 
-CodeBlock::CodeBlock(unsigned int s, Cell *txt) : size(s), text(txt) {}
+CodeBlock::CodeBlock(unsigned int s, Cell *txt)
+: size(s), text(txt), call_count(0), native(NULL), verified(false), source(NULL), source_offset(0) {}
+
+CodeBlock::~CodeBlock()
+{
+	#ifdef OOPART_JIT
+	if (native != NULL) jit_release(native);
+	#endif
+}
+
+/* handlers add entry points, so a verified block has to be proven again */
+void CodeBlock::add_handler(const ExceptionHandler &handler)
+{
+	if (handler.begin >= handler.end || handler.end > size || handler.target >= size || handler.depth < 0)
+	{
+		throw ExecutionOutOfBoundsError(std::string("Exception handler outside of code bounds"));
+	}
+	/* installing the same handler again, e.g. on every call, leaves the table as it is */
+	for (unsigned int i=0; i<handlers.size(); ++i)
+	{
+		const ExceptionHandler &other = handlers[i];
+		if (other.begin == handler.begin && other.end == handler.end && other.target == handler.target && other.depth == handler.depth) return;
+	}
+	handlers.push_back(handler);
+	if (verified)
+	{
+		verified = false;
+		verify_procedure(this);
+	}
+}
+
+const ExceptionHandler *CodeBlock::find_handler(unsigned int index) const
+{
+	for (unsigned int i=0; i<handlers.size(); ++i)
+	{
+		if (index >= handlers[i].begin && index < handlers[i].end) return &handlers[i];
+	}
+	return NULL;
+}
+
+const Cell *CodeBlock::cells() const
+{
+	return source != NULL ? source->text + source_offset : text;
+}
 
 std::string CodeBlock::toString() const
 {
 	std::stringstream output;
+	/* an unresolved block shows the cells it will be built from */
+	const Cell *text = cells();
 	output << "size=" << size << ", [";
 	for (unsigned int i=0; i<size; ++i)
 	{
@@ -216,6 +368,17 @@ void Dictionary::define(std::string key, CodeBlock* value)
 RuntimeMachine::RuntimeMachine()
 : object_storage()	{
 	this->global_object = new Object;
+	this->request_globals = 0;
+	/* operand stack grows in place; avoid reallocating on small programs */
+	this->argument_stack.reserve(256);
+	#ifdef OOPART_JIT
+	this->jit_enabled = true;
+	#else
+	this->jit_enabled = false;
+	#endif
+	this->limits.fuel = LLONG_MAX;
+	this->limits.pending.store(0);
+	this->fuel_limited = false;
 	this->reset();
 }
 RuntimeMachine::~RuntimeMachine() {
@@ -226,6 +389,10 @@ void RuntimeMachine::reset()
 	argument_stack.clear();
 	return_stack.clear();
 	continue_execution = false;
+	execution_status = EXECUTION_FINISHED;
+	io_descriptor = -1;
+	io_events = 0;
+	limits.pending.fetch_and(~LIMIT_INTERRUPT);
 }
 
 StackFrame& RuntimeMachine::current_stack_frame()
@@ -233,19 +400,41 @@ StackFrame& RuntimeMachine::current_stack_frame()
 	return return_stack.front();
 }
 
+bool RuntimeMachine::is_running(const CodeBlock *code) const
+{
+	for (std::list<StackFrame>::const_iterator iter=return_stack.begin(); iter!=return_stack.end(); ++iter)
+	{
+		if (iter->code == code) return true;
+	}
+	return false;
+}
+
 /* internal functions used by instructions */
 void RuntimeMachine::push_argument(Cell c)
 {
-	argument_stack.push_front(c);
+	argument_stack.push_back(c);
 }
 
 Cell RuntimeMachine::pop_argument()
 {
-	Cell value = argument_stack.front();
-	argument_stack.pop_front();
+	if (argument_stack.empty())
+	{
+		throw ExecutionOutOfBoundsError(std::string("Pop from empty argument stack"));
+	}
+	Cell value = argument_stack.back();
+	argument_stack.pop_back();
 	return value;
 }
 
+/* pops the top cell only if it is an INT32; never throws */
+bool RuntimeMachine::try_pop_int32(int *value)
+{
+	if (argument_stack.empty() || argument_stack.back().type != INT32) return false;
+	*value = argument_stack.back().int32;
+	argument_stack.pop_back();
+	return true;
+}
+
 Cell RuntimeMachine::read_byte()
 {
 	StackFrame &current = this->current_stack_frame();
@@ -261,6 +450,76 @@ Cell RuntimeMachine::read_byte()
 	}
 }
 
+/* move the current frame's location pointer, relative to the cell after the offset operand */
+void RuntimeMachine::jump_relative(int offset)
+{
+	StackFrame &current = this->current_stack_frame();
+	/* checked as an index: a pointer outside the block is undefined before it is ever compared */
+	long long index = static_cast<long long>(current.location_pointer - current.begin()) + offset;
+	if ( index < 0 || index >= current.code->size )
+	{
+		throw ExecutionOutOfBoundsError(std::string("Jump past code bounds"));
+	}
+	Cell *target = current.begin() + index;
+	current.location_pointer = target;
+
+	if (offset < 0 && !at_safepoint()) count_backward_jump(current.code, target);
+}
+
+/* loops make a block hot even when it is only called once; true once native code can take over at target */
+bool RuntimeMachine::count_backward_jump(const CodeBlock *code, const Cell *target)
+{
+	#ifdef OOPART_JIT
+	if (!jit_enabled) return false;
+	if (code->native == NULL && ++code->call_count >= JIT_THRESHOLD)
+	{
+		code->native = jit_compile(code);
+	}
+	return code->native != NULL && jit_can_enter(code->native, static_cast<unsigned int>(target - code->text));
+	#else
+	(void)code;
+	(void)target;
+	return false;
+	#endif
+}
+
+/*
+	Slow path of at_safepoint. Suspending stops the dispatch loop with the
+	location pointer already at the cell to run next, which is all resume needs.
+*/
+bool RuntimeMachine::check_limits()
+{
+	ExecutionStatus reason = EXECUTION_FINISHED;
+	int pending = limits.pending.load(std::memory_order_relaxed);
+	if (pending & LIMIT_INTERRUPT)
+	{
+		limits.pending.fetch_and(~LIMIT_INTERRUPT);
+		reason = EXECUTION_INTERRUPTED;
+	}
+	else if ((pending & LIMIT_HEAP) && object_storage.over_heap_limit())
+	{
+		reason = EXECUTION_HEAP_LIMIT;
+	}
+	else
+	{
+		if (pending & LIMIT_HEAP) limits.pending.fetch_and(~LIMIT_HEAP);
+		if (limits.fuel >= 0) return false;
+		limits.fuel = fuel_limited ? 0 : LLONG_MAX;
+		if (!fuel_limited) return false;
+		reason = EXECUTION_OUT_OF_FUEL;
+	}
+	execution_status = reason;
+	continue_execution = false;
+	return true;
+}
+
+void RuntimeMachine::wait_for_io(int descriptor, unsigned int events)
+{
+	io_descriptor = descriptor;
+	io_events = events;
+	execution_status = EXECUTION_WAITING_IO;
+	continue_execution = false;
+}
 
 void RuntimeMachine::halt()
 {
@@ -273,14 +532,19 @@ void RuntimeMachine::halt()
 	someday this will involve a multi-namespace lookup
 */
 
-CodeBlock* RuntimeMachine::lookup_word(std::string key)
+CodeBlock* RuntimeMachine::lookup_word(const std::string &key)
 {
-	char *key_str = strdup(key.c_str());
-	Cell tmpkey(key_str);
-
-	Cell value = this->global_object->getattr(tmpkey);
-
-	free(key_str);
+	/* getattr only compares the characters, so the key can borrow them */
+	Cell value;
+	try
+	{
+		value = this->global_object->getattr(Cell(const_cast<char*>(key.c_str())));
+	}
+	catch (KeyNotFoundException&)
+	{
+		/* the error outlives this call, so it gets a managed copy of the key */
+		throw KeyNotFoundException(Cell(this->create_string(key.c_str())));
+	}
 
 	value.assert_type(PROCEDURE, std::string("RuntimeMachine::lookup_word(") + key + ")");
 	return value.procedure;
@@ -295,6 +559,20 @@ void RuntimeMachine::define_word(std::string name, CodeBlock* code)
 	//throw NotImplementedError(std::string("RuntimeMachine::define_word(") + name + ", " + code->toString() + ")");
 }
 
+CodeBlock* RuntimeMachine::define_host_function(const std::string &name, unsigned int arity, HostFunction function, void *data)
+{
+	HostBinding binding = { function, data, arity };
+	host_functions.push_back(binding);
+
+	CodeBlock *code = create_anonymous_procedure(3);
+	code->text[0] = Cell(OP_call_host_function);
+	code->text[1] = Cell(static_cast<int>(host_functions.size() - 1));
+	code->text[2] = Cell(OP_return_from_function);
+	verify_procedure(code);
+	define_word(name, code);
+	return code;
+}
+
 
 /* allocate managed memory */
 CodeBlock* RuntimeMachine::create_anonymous_procedure(unsigned int length)
@@ -312,15 +590,68 @@ char* RuntimeMachine::create_string(const char *other)
 	return object_storage.duplicate_string(other);
 }
 
+String* RuntimeMachine::create_managed_string(const char *chars, unsigned int length)
+{
+	return object_storage.create_managed_string(chars, length);
+}
+
+String* RuntimeMachine::create_string_slice(String *parent, unsigned int start, unsigned int length)
+{
+	return object_storage.create_string_slice(parent, start, length);
+}
+
+String* RuntimeMachine::create_string_concatenation(String *lhs, String *rhs)
+{
+	return object_storage.create_string_concatenation(lhs, rhs);
+}
+
+Error* RuntimeMachine::create_error(ErrorKind kind, Cell value, std::exception_ptr cause)
+{
+	return object_storage.create_error(kind, value, cause);
+}
+
+Array* RuntimeMachine::create_array(ElementType t, unsigned int length)
+{
+	return object_storage.create_array(t, length);
+}
+
+Array* RuntimeMachine::create_array_slice(Array *parent, unsigned int start, unsigned int length)
+{
+	return object_storage.create_array_slice(parent, start, length);
+}
+
 
 /* execution */
 
 void RuntimeMachine::execute_next_instruction()
+{
+	StackFrame &frame = current_stack_frame();
+	#ifdef OOPART_JIT
+	if (frame.code->native != NULL && jit_enabled)
+	{
+		/* native code hands back the cell it could not run; interpret that one below */
+		jit_enter(this, frame);
+		if (!continue_execution) return;
+	}
+	#endif
+
+	if (frame.code->verified)
+	{
+		execute_verified(frame);
+	}
+	else
+	{
+		execute_checked_instruction();
+	}
+}
+
+void RuntimeMachine::execute_checked_instruction()
 {
 	Cell byte = read_byte();
 	if (byte.type == INSTRUCTION)
 	{
-		byte.instruction(this);
+		if (byte.opcode >= OPCODE_COUNT) throw UnknownFunctionError("Invalid opcode");
+		instruction_table[byte.opcode].function(this);
 	}
 	else if (byte.type == PROCEDURE)
 	{
@@ -348,38 +679,250 @@ void RuntimeMachine::execute_next_instruction()
 	}
 }
 
-void RuntimeMachine::compile_next_instruction(CodeBlock *dest, int index)
+/* rhand is on top of the stack, lhand directly below it; both are proven by the verifier */
+#define unchecked_binary(opcode, member, op) \
+	case opcode: { \
+		Cell &lhand = stack[stack.size() - 2]; \
+		lhand.member = lhand.member op stack.back().member; \
+		stack.pop_back(); \
+		ip += 1; \
+		break; \
+	}
+
+/* on overflow the checked instruction runs instead and raises */
+#define unchecked_overflow(opcode, member, builtin) \
+	case opcode: { \
+		Cell &lhand = stack[stack.size() - 2]; \
+		if (builtin(lhand.member, stack.back().member, &result.member)) goto checked; \
+		lhand.member = result.member; \
+		stack.pop_back(); \
+		ip += 1; \
+		break; \
+	}
+
+#define unchecked_division(opcode, member, op, minimum) \
+	case opcode: { \
+		Cell &lhand = stack[stack.size() - 2]; \
+		if (stack.back().member == 0 || (stack.back().member == -1 && lhand.member == minimum)) goto checked; \
+		lhand.member = lhand.member op stack.back().member; \
+		stack.pop_back(); \
+		ip += 1; \
+		break; \
+	}
+
+#define unchecked_negate(opcode, member, minimum) \
+	case opcode: { \
+		Cell &value = stack.back(); \
+		if (value.member == minimum) goto checked; \
+		value.member = -value.member; \
+		ip += 1; \
+		break; \
+	}
+
+#define unchecked_comparison(opcode, member, op) \
+	case opcode: { \
+		Cell &lhand = stack[stack.size() - 2]; \
+		lhand = Cell(static_cast<int>(lhand.member op stack.back().member)); \
+		stack.pop_back(); \
+		ip += 1; \
+		break; \
+	}
+
+#define unchecked_typed_family(suffix, member, minimum) \
+	unchecked_overflow(OP_add_##suffix, member, __builtin_add_overflow) \
+	unchecked_overflow(OP_subtract_##suffix, member, __builtin_sub_overflow) \
+	unchecked_overflow(OP_multiply_##suffix, member, __builtin_mul_overflow) \
+	unchecked_division(OP_divide_##suffix, member, /, minimum) \
+	unchecked_division(OP_modulo_##suffix, member, %, minimum) \
+	unchecked_negate(OP_negate_##suffix, member, minimum) \
+	unchecked_comparison(OP_equal_##suffix, member, ==) \
+	unchecked_comparison(OP_not_equal_##suffix, member, !=) \
+	unchecked_comparison(OP_less_##suffix, member, <) \
+	unchecked_comparison(OP_less_equal_##suffix, member, <=) \
+	unchecked_comparison(OP_greater_##suffix, member, >) \
+	unchecked_comparison(OP_greater_equal_##suffix, member, >=)
+
+/*
+	Runs a verified block until control leaves its frame. Only
+	INSTRUCTION_UNCHECKED instructions run here; calls and everything else go
+	through the checked path with the location pointer in sync.
+*/
+void RuntimeMachine::execute_verified(StackFrame &frame)
 {
-	Cell byte = read_byte();
-	if (byte.type == INSTRUCTION || byte.type == PROCEDURE)
+	std::vector<Cell> &stack = argument_stack;
+	Cell *ip = frame.location_pointer;
+	Cell result;
+
+	while (true)
 	{
-		dest->text[index] = byte;
+		if (ip->type != INSTRUCTION || !(instruction_table[ip->opcode].flags & INSTRUCTION_UNCHECKED))
+		{
+			goto checked;
+		}
+
+		switch (ip->opcode)
+		{
+			case OP_load_immediate: {
+				stack.push_back(ip[1]);
+				ip += 2;
+				break;
+			}
+			case OP_duplicate: {
+				Cell top = stack.back();
+				stack.push_back(top);
+				ip += 1;
+				break;
+			}
+			case OP_drop: {
+				stack.pop_back();
+				ip += 1;
+				break;
+			}
+			case OP_swap: {
+				std::swap(stack[stack.size() - 1], stack[stack.size() - 2]);
+				ip += 1;
+				break;
+			}
+			case OP_over: {
+				Cell second = stack[stack.size() - 2];
+				stack.push_back(second);
+				ip += 1;
+				break;
+			}
+
+			unchecked_typed_family(int32, int32, INT_MIN)
+			unchecked_typed_family(int64, int64, LLONG_MIN)
+
+			unchecked_binary(OP_add_float64, float64, +)
+			unchecked_binary(OP_subtract_float64, float64, -)
+			unchecked_binary(OP_multiply_float64, float64, *)
+			unchecked_binary(OP_divide_float64, float64, /)
+			case OP_negate_float64: {
+				stack.back().float64 = -stack.back().float64;
+				ip += 1;
+				break;
+			}
+			unchecked_comparison(OP_equal_float64, float64, ==)
+			unchecked_comparison(OP_not_equal_float64, float64, !=)
+			unchecked_comparison(OP_less_float64, float64, <)
+			unchecked_comparison(OP_less_equal_float64, float64, <=)
+			unchecked_comparison(OP_greater_float64, float64, >)
+			unchecked_comparison(OP_greater_equal_float64, float64, >=)
+
+			case OP_jump_relative:
+			case OP_jump_if_zero:
+			case OP_jump_if_nonzero: {
+				bool taken = true;
+				if (ip->opcode != OP_jump_relative)
+				{
+					taken = (stack.back().int32 == 0) == (ip->opcode == OP_jump_if_zero);
+					stack.pop_back();
+				}
+				int offset = ip[1].int32;
+				ip += 2;
+				if (!taken) break;
+				ip += offset;
+				if (offset < 0 && (at_safepoint() || count_backward_jump(frame.code, ip)))
+				{
+					/* suspended, or let execute_next_instruction enter the native code */
+					frame.location_pointer = ip;
+					return;
+				}
+				break;
+			}
+			default:
+				goto checked;
+		}
+		continue;
+
+	checked:
+		frame.location_pointer = ip;
+		execute_checked_instruction();
+		if (!continue_execution || return_stack.empty() || &return_stack.front() != &frame) return;
+		ip = frame.location_pointer;
 	}
-	else if (byte.type == ZSTRING)
+}
+
+#undef unchecked_binary
+#undef unchecked_overflow
+#undef unchecked_division
+#undef unchecked_negate
+#undef unchecked_comparison
+#undef unchecked_typed_family
+
+/*
+	Copies the body out of the block that compiled it, replacing the names of
+	defined words with their procedures. An undefined name throws, and leaves
+	the block to be resolved again on its next call. A block that outlives
+	the current request is not bound to words the request defined, which
+	are freed when it ends; those names are looked up each time they run.
+*/
+void RuntimeMachine::resolve_procedure(const CodeBlock *code)
+{
+	const Cell *from = code->source->text + code->source_offset;
+	bool outlives_request = !object_storage.in_arena(Cell(const_cast<CodeBlock*>(code)));
+	for (unsigned int i=0; i<code->size; ++i)
 	{
-		std::string key(byte.string);
-		CodeBlock *code = this->lookup_word(key);
-		if (code->size > 0)
+		Cell byte = from[i];
+		if (byte.type == ZSTRING)
 		{
-			dest->text[index] = Cell(code);
+			CodeBlock *word = this->lookup_word(byte.string);
+			// a word without a body yet is assumed forward-declared, and looked up when run
+			bool bind = word->size > 0 && !(outlives_request && object_storage.in_arena(Cell(word)));
+			code->text[i] = bind ? Cell(word) : byte;
+		}
+		else if (byte.type == INSTRUCTION && byte.opcode == OP_compile_procedure && i + 1 < code->size && from[i + 1].type == INT32)
+		{
+			/* nested bodies are copied as they are and resolved on their own first call */
+			unsigned int length = from[i + 1].int32 > 0 ? static_cast<unsigned int>(from[i + 1].int32) : 0;
+			unsigned int end = std::min(code->size, i + 2 + length);
+			std::copy(from + i, from + end, code->text + i);
+			i = end - 1;
 		}
 		else
 		{
-			// assume forward-declared function
-			dest->text[index] = byte;
+			code->text[i] = byte;
 		}
 	}
-	else
-	{
-		dest->text[index] = byte;
-	}
+	code->source = NULL;
+	verify_procedure(code);
 }
 
 void RuntimeMachine::call_function(Object *new_context, const CodeBlock *code)
 {
-	
+	resolve_if_lazy(code);
+
+	#ifdef OOPART_JIT
+	if (jit_enabled && code->native == NULL && ++code->call_count >= JIT_THRESHOLD)
+	{
+		code->native = jit_compile(code);
+	}
+	#endif
+
 	StackFrame newframe(code, new_context, code->text);
+	newframe.stack_base = argument_stack.size();
 	return_stack.push_front(newframe);
+	at_safepoint();
+}
+
+/* the arguments stay below the results until the function returns; see embedding.hpp */
+void RuntimeMachine::call_host_function(unsigned int index)
+{
+	if (index >= host_functions.size())
+	{
+		throw UnknownFunctionError("RuntimeMachine::call_host_function - no host function " + Cell(static_cast<int>(index)).toString());
+	}
+	/* a copy: the function may register others and move the table */
+	HostBinding binding = host_functions[index];
+	if (argument_stack.size() < binding.arity)
+	{
+		throw ExecutionOutOfBoundsError("RuntimeMachine::call_host_function - too few arguments");
+	}
+
+	unsigned int base = argument_stack.size() - binding.arity;
+	HostCall call(this, base, binding.arity);
+	binding.function(call, binding.data);
+	argument_stack.erase(argument_stack.begin() + base, argument_stack.begin() + base + binding.arity);
 }
 
 void RuntimeMachine::restore_stack_frame()
@@ -387,29 +930,222 @@ void RuntimeMachine::restore_stack_frame()
 	return_stack.pop_front();
 }
 
+/*
+	Unwinds to the first handler covering the faulting cell, frame by frame.
+	Frames without one are dropped; when none are left the error escapes
+	execute, as the C++ exception that caused it if there was one.
+*/
+void RuntimeMachine::raise_error(Error *error)
+{
+	unsigned int base = argument_stack.size();
+	while (!return_stack.empty())
+	{
+		StackFrame &frame = return_stack.front();
+		/* the location pointer has already moved past the faulting cell */
+		unsigned int index = static_cast<unsigned int>(frame.location_pointer - frame.begin());
+		if (index > 0) index -= 1;
+
+		const ExceptionHandler *handler = frame.code->find_handler(index);
+		if (handler != NULL)
+		{
+			/* add_handler refuses negative depths, so this never reaches below the frame */
+			size_t height = static_cast<size_t>(frame.stack_base) + handler->depth;
+			if (height < argument_stack.size()) argument_stack.resize(height);
+			frame.location_pointer = frame.begin() + handler->target;
+			argument_stack.push_back(Cell(error));
+			return;
+		}
+		base = frame.stack_base;
+		return_stack.pop_front();
+	}
+
+	if (base < argument_stack.size()) argument_stack.resize(base);
+	continue_execution = false;
+
+	/* format now, while everything the message refers to is still alive */
+	std::string message = error->message();
+	if (error->cause) std::rethrow_exception(error->cause);
+	throw UncaughtError(message);
+}
+
+/* called from a catch block: turns the exception being handled into a bytecode error */
+void RuntimeMachine::raise_exception(ErrorKind kind, Cell value)
+{
+	if (return_stack.empty()) throw;
+	raise_error(create_error(kind, value, std::current_exception()));
+}
+
 Cell RuntimeMachine::execute(const CodeBlock *block)
 {
-	continue_execution = true;
+	resolve_if_lazy(block);
 	StackFrame current(block, global_object, block->text);
+	current.stack_base = argument_stack.size();
 	return_stack.push_front(current);	
+	execution_status = EXECUTION_FINISHED;
+	continue_execution = true;
+	run();
 
-	while (continue_execution)
+	if (argument_stack.size() > 0)
+	{
+		return argument_stack.back();
+	}
+	else return Cell(0);
+}
+
+/* continues a suspended execute; the result means the same as execute's once status() is EXECUTION_FINISHED */
+Cell RuntimeMachine::resume()
+{
+	if (execution_status == EXECUTION_FINISHED || return_stack.empty())
 	{
-		execute_next_instruction();
+		throw ExecutionOutOfBoundsError(std::string("No suspended execution to resume"));
 	}
+	execution_status = EXECUTION_FINISHED;
+	continue_execution = true;
+	run();
 
 	if (argument_stack.size() > 0)
 	{
-		return argument_stack.front();
+		return argument_stack.back();
 	}
 	else return Cell(0);
 }
 
+void RuntimeMachine::run()
+{
+	/* try blocks cost nothing until something throws */
+	while (continue_execution)
+	{
+		try
+		{
+			while (continue_execution)
+			{
+				execute_next_instruction();
+			}
+		}
+		catch (CellTypeException&) { raise_exception(ERROR_TYPE, Cell()); }
+		catch (KeyNotFoundException &e) { raise_exception(ERROR_KEY_NOT_FOUND, e.key); }
+		catch (ExecutionOutOfBoundsError&) { raise_exception(ERROR_OUT_OF_BOUNDS, Cell()); }
+		catch (UnknownFunctionError&) { raise_exception(ERROR_UNKNOWN_FUNCTION, Cell()); }
+		catch (NotImplementedError&) { raise_exception(ERROR_NOT_IMPLEMENTED, Cell()); }
+		catch (ArithmeticError&) { raise_exception(ERROR_ARITHMETIC, Cell()); }
+		catch (IoError&) { raise_exception(ERROR_IO, Cell()); }
+		catch (HeapLimitError&) { raise_exception(ERROR_HEAP_LIMIT, Cell()); }
+	}
+}
+
+void RuntimeMachine::set_fuel(unsigned long long units)
+{
+	fuel_limited = units != 0;
+	limits.fuel = fuel_limited && units < LLONG_MAX ? static_cast<long long>(units) : LLONG_MAX;
+}
+
+void RuntimeMachine::set_heap_limit(size_t bytes)
+{
+	object_storage.set_heap_limit(bytes, &limits.pending);
+}
+
+void RuntimeMachine::interrupt()
+{
+	limits.pending.fetch_or(LIMIT_INTERRUPT);
+}
+
+void RuntimeMachine::set_jit_enabled(bool enabled)
+{
+	#ifdef OOPART_JIT
+	jit_enabled = enabled;
+	#else
+	(void)enabled;
+	#endif
+}
+
+/*
+	The cells a collection starts marking from: the operand stack, the words
+	and globals, and every running frame. Blocks the host built itself are
+	not tracked, so the cells of running ones are added directly.
+*/
+void RuntimeMachine::gc_roots(std::vector<Cell> &roots) const
+{
+	roots.insert(roots.end(), argument_stack.begin(), argument_stack.end());
+
+	for (ObjectIterator iter = global_object->begin(); iter != global_object->end(); ++iter)
+	{
+		roots.push_back(*(iter.key));
+		roots.push_back(*(iter.value));
+	}
+	/* globals a request replaced come back at end_request */
+	for (AttributeJournal::const_iterator iter=request_overwrites.begin(); iter!=request_overwrites.end(); ++iter)
+	{
+		roots.push_back(iter->second);
+	}
+
+	std::set<const CodeBlock*> running;
+	for (std::list<StackFrame>::const_iterator frame=return_stack.begin(); frame!=return_stack.end(); ++frame)
+	{
+		if (frame->context != global_object) roots.push_back(Cell(frame->context));
+		if (!running.insert(frame->code).second) continue;
+		roots.push_back(Cell(const_cast<CodeBlock*>(frame->code)));
+		roots.insert(roots.end(), frame->code->text, frame->code->text + frame->code->size);
+	}
+}
+
 void RuntimeMachine::collect_garbage()
 {
-	for (std::list<Cell>::iterator iter=argument_stack.begin(); iter!=argument_stack.end(); ++iter)
+	std::vector<Cell> roots;
+	gc_roots(roots);
+	object_storage.collect(roots);
+}
+
+void RuntimeMachine::set_collection_callback(CollectionCallback callback, void *data)
+{
+	object_storage.set_collection_callback(callback, data);
+}
+
+void RuntimeMachine::dump_heap(std::ostream &output) const
+{
+	std::vector<Cell> roots;
+	gc_roots(roots);
+	object_storage.dump_heap(output, roots);
+}
+
+void RuntimeMachine::dump_heap(const std::string &path) const
+{
+	std::ofstream output(path.c_str());
+	if (output) dump_heap(output);
+	if (!output) throw std::runtime_error(std::string("RuntimeMachine::dump_heap - could not write ") + path);
+}
+
+/*
+	Everything allocated between begin_request and end_request is released
+	at the end in one pass. Globals added meanwhile are forgotten and the ones
+	overwritten get their old values back, so the next request sees the
+	machine as it was. Values that must survive have to be promoted, and stay
+	alive only while something still refers to them.
+*/
+void RuntimeMachine::begin_request()
+{
+	reset();
+	request_globals = global_object->size();
+	request_overwrites.clear();
+	global_object->set_journal(&request_overwrites);
+	object_storage.begin_arena();
+}
+
+void RuntimeMachine::end_request()
+{
+	reset();
+	global_object->set_journal(NULL);
+	/* newest first, so a global overwritten twice ends with its value from before the request */
+	for (AttributeJournal::reverse_iterator iter=request_overwrites.rbegin(); iter!=request_overwrites.rend(); ++iter)
 	{
-		object_storage.mark(*iter);
+		global_object->setattr(iter->first, iter->second);
 	}
-	object_storage.sweep();
+	request_overwrites.clear();
+	global_object->restore_size(request_globals);
+	object_storage.end_arena();
+}
+
+Cell RuntimeMachine::promote(Cell c)
+{
+	object_storage.promote(c);
+	return c;
 }
@@ -0,0 +1,379 @@
+#include "io.hpp"
+#include "instructions.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+static IoError io_error(const char *operation)
+{
+	return IoError(std::string(operation) + ": " + strerror(errno));
+}
+
+static bool would_block(int error)
+{
+	return error == EAGAIN || error == EWOULDBLOCK;
+}
+
+/* puts the instruction back so it runs again once fd is ready; the caller has restored its operands */
+static void retry_when_ready(RuntimeMachine *meta, int fd, unsigned int events)
+{
+	--meta->current_stack_frame().location_pointer;
+	meta->wait_for_io(fd, events);
+}
+
+static std::string text_operand(Cell c, const char *context)
+{
+	if (c.type == ZSTRING) return std::string(c.string);
+	if (c.type == STRING) return c.str->toString();
+	throw CellTypeException(STRING, c.type, context);
+}
+
+static int descriptor_operand(Cell c, const char *context)
+{
+	c.assert_type(INT32, context);
+	if (c.int32 < 0) throw IoError(std::string(context) + ": negative descriptor");
+	return c.int32;
+}
+
+static sockaddr_in socket_address(Cell host, Cell port, const char *context)
+{
+	std::string address = text_operand(host, context);
+	port.assert_type(INT32, context);
+	if (port.int32 < 0 || port.int32 > 65535) throw ExecutionOutOfBoundsError(std::string(context) + " - port out of range");
+
+	sockaddr_in result;
+	memset(&result, 0, sizeof(result));
+	result.sin_family = AF_INET;
+	result.sin_port = htons(static_cast<unsigned short>(port.int32));
+	if (inet_pton(AF_INET, address.c_str(), &result.sin_addr) != 1)
+	{
+		throw IoError(std::string(context) + ": not an IPv4 address: " + address);
+	}
+	return result;
+}
+
+static int stream_socket(const char *context)
+{
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) throw io_error(context);
+	return fd;
+}
+
+
+/* instructions */
+void io_open(RuntimeMachine *meta)
+{
+	Cell mode = meta->pop_argument();
+	Cell path = meta->pop_argument();
+	mode.assert_type(INT32, "io_open.mode");
+
+	int flags = O_NONBLOCK | O_CLOEXEC;
+	switch (mode.int32)
+	{
+		case IO_OPEN_READ: flags |= O_RDONLY; break;
+		case IO_OPEN_WRITE: flags |= O_WRONLY | O_CREAT | O_TRUNC; break;
+		case IO_OPEN_APPEND: flags |= O_WRONLY | O_CREAT | O_APPEND; break;
+		default: throw ExecutionOutOfBoundsError("io_open - unknown mode");
+	}
+
+	int fd = open(text_operand(path, "io_open.path").c_str(), flags, 0666);
+	if (fd < 0) throw io_error("io_open");
+	meta->push_argument(Cell(fd));
+}
+
+void io_connect(RuntimeMachine *meta)
+{
+	Cell port = meta->pop_argument();
+	Cell host = meta->pop_argument();
+	sockaddr_in address = socket_address(host, port, "io_connect");
+
+	int fd = stream_socket("io_connect");
+	if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0)
+	{
+		meta->push_argument(Cell(fd));
+		return;
+	}
+	if (errno != EINPROGRESS)
+	{
+		IoError error = io_error("io_connect");
+		close(fd);
+		throw error;
+	}
+
+	/* the socket is the result either way; a refused connection fails the first read or write */
+	meta->push_argument(Cell(fd));
+	meta->wait_for_io(fd, IO_WRITABLE);
+}
+
+void io_listen(RuntimeMachine *meta)
+{
+	Cell port = meta->pop_argument();
+	Cell host = meta->pop_argument();
+	sockaddr_in address = socket_address(host, port, "io_listen");
+
+	int fd = stream_socket("io_listen");
+	int reuse = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		IoError error = io_error("io_listen");
+		close(fd);
+		throw error;
+	}
+	meta->push_argument(Cell(fd));
+}
+
+void io_local_port(RuntimeMachine *meta)
+{
+	int fd = descriptor_operand(meta->pop_argument(), "io_local_port");
+	sockaddr_in address;
+	socklen_t length = sizeof(address);
+	if (getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) throw io_error("io_local_port");
+	if (address.sin_family != AF_INET) throw IoError("io_local_port: not an IPv4 socket");
+	meta->push_argument(Cell(static_cast<int>(ntohs(address.sin_port))));
+}
+
+void io_accept(RuntimeMachine *meta)
+{
+	Cell listener = meta->pop_argument();
+	int fd = descriptor_operand(listener, "io_accept");
+
+	for (;;)
+	{
+		int client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client >= 0)
+		{
+			meta->push_argument(Cell(client));
+			return;
+		}
+		if (errno == EINTR || errno == ECONNABORTED) continue;
+		if (!would_block(errno)) throw io_error("io_accept");
+
+		meta->push_argument(listener);
+		retry_when_ready(meta, fd, IO_READABLE);
+		return;
+	}
+}
+
+void io_read(RuntimeMachine *meta)
+{
+	Cell target = meta->pop_argument();
+	Cell buffer = meta->pop_argument();
+	int fd = descriptor_operand(target, "io_read");
+	buffer.assert_type(ARRAY, "io_read.buffer");
+	Array *array = buffer.array;
+	if (array->element_type != ELEMENT_BYTE) throw CellTypeException("io_read - buffer must be a byte array");
+
+	for (;;)
+	{
+		ssize_t count = read(fd, array->data, array->length);
+		if (count >= 0)
+		{
+			meta->push_argument(Cell(static_cast<int>(count)));
+			return;
+		}
+		if (errno == EINTR) continue;
+		if (!would_block(errno)) throw io_error("io_read");
+
+		meta->push_argument(buffer);
+		meta->push_argument(target);
+		retry_when_ready(meta, fd, IO_READABLE);
+		return;
+	}
+}
+
+void io_write(RuntimeMachine *meta)
+{
+	Cell target = meta->pop_argument();
+	Cell data = meta->pop_argument();
+	int fd = descriptor_operand(target, "io_write");
+
+	const void *bytes;
+	size_t length;
+	if (data.type == ARRAY)
+	{
+		bytes = data.array->data;
+		length = Array::byteSize(data.array->element_type, data.array->length);
+	}
+	else if (data.type == STRING)
+	{
+		bytes = data.str->data();
+		length = data.str->length;
+	}
+	else throw CellTypeException(STRING, data.type, "io_write.data");
+
+	for (;;)
+	{
+		/* send keeps a closed peer from raising SIGPIPE; anything but a socket falls back to write */
+		ssize_t count = send(fd, bytes, length, MSG_NOSIGNAL);
+		if (count < 0 && errno == ENOTSOCK) count = write(fd, bytes, length);
+		if (count >= 0)
+		{
+			meta->push_argument(Cell(static_cast<int>(count)));
+			return;
+		}
+		if (errno == EINTR) continue;
+		if (!would_block(errno)) throw io_error("io_write");
+
+		meta->push_argument(data);
+		meta->push_argument(target);
+		retry_when_ready(meta, fd, IO_WRITABLE);
+		return;
+	}
+}
+
+void io_close(RuntimeMachine *meta)
+{
+	int fd = descriptor_operand(meta->pop_argument(), "io_close");
+	if (close(fd) != 0 && errno != EINTR) throw io_error("io_close");
+}
+
+
+/* event loop */
+EventLoop::EventLoop()
+: waiting(0), completion(NULL), completion_data(NULL)
+{
+	epoll_descriptor = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_descriptor < 0) throw io_error("EventLoop");
+}
+
+EventLoop::~EventLoop()
+{
+	close(epoll_descriptor);
+}
+
+void EventLoop::set_completion_callback(CompletionCallback callback, void *data)
+{
+	completion = callback;
+	completion_data = data;
+}
+
+/*
+	Descriptors are armed one-shot, so a wakeup disarms them and an fd that
+	is waited on again only needs re-arming. Closing an fd drops it from the
+	epoll set, so a reused number is added afresh.
+*/
+void EventLoop::watch(RuntimeMachine *machine)
+{
+	int fd = machine->waiting_descriptor();
+	if (fd >= static_cast<int>(watchers.size())) watchers.resize(fd + 1, NULL);
+	if (watchers[fd] != NULL)
+	{
+		finish(machine, std::make_exception_ptr(IoError("EventLoop: another machine is waiting on this descriptor")));
+		return;
+	}
+
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLONESHOT;
+	if (machine->waiting_events() & IO_READABLE) event.events |= EPOLLIN;
+	if (machine->waiting_events() & IO_WRITABLE) event.events |= EPOLLOUT;
+	event.data.ptr = machine;
+
+	int result = epoll_ctl(epoll_descriptor, EPOLL_CTL_MOD, fd, &event);
+	if (result != 0 && errno == ENOENT) result = epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, fd, &event);
+	if (result != 0)
+	{
+		/* regular files cannot be polled and never block */
+		if (errno == EPERM) ready.push_back(machine);
+		else finish(machine, std::make_exception_ptr(io_error("EventLoop")));
+		return;
+	}
+	watchers[fd] = machine;
+	++waiting;
+}
+
+void EventLoop::dispatch(RuntimeMachine *machine)
+{
+	if (machine->status() == EXECUTION_WAITING_IO) watch(machine);
+	else finish(machine, std::exception_ptr());
+}
+
+void EventLoop::finish(RuntimeMachine *machine, std::exception_ptr error)
+{
+	if (completion != NULL) completion(machine, error, completion_data);
+}
+
+void EventLoop::resume(RuntimeMachine *machine)
+{
+	try
+	{
+		machine->resume();
+	}
+	catch (...)
+	{
+		finish(machine, std::current_exception());
+		return;
+	}
+	dispatch(machine);
+}
+
+void EventLoop::start(RuntimeMachine *machine, const CodeBlock *code)
+{
+	try
+	{
+		machine->execute(code);
+	}
+	catch (...)
+	{
+		finish(machine, std::current_exception());
+		return;
+	}
+	dispatch(machine);
+}
+
+void EventLoop::schedule(RuntimeMachine *machine)
+{
+	ready.push_back(machine);
+}
+
+unsigned int EventLoop::run_once(int timeout)
+{
+	unsigned int resumed = 0;
+
+	std::vector<RuntimeMachine*> runnable;
+	runnable.swap(ready);
+	for (unsigned int i=0; i<runnable.size(); ++i)
+	{
+		resume(runnable[i]);
+		++resumed;
+	}
+	if (waiting == 0) return resumed;
+
+	epoll_event events[256];
+	int count = epoll_wait(epoll_descriptor, events, 256, resumed > 0 || !ready.empty() ? 0 : timeout);
+	if (count < 0)
+	{
+		if (errno == EINTR) return resumed;
+		throw io_error("EventLoop::run_once");
+	}
+
+	/* unregister the whole batch first: resuming one may wait on a descriptor another woke on */
+	RuntimeMachine *woken[256];
+	for (int i=0; i<count; ++i)
+	{
+		woken[i] = static_cast<RuntimeMachine*>(events[i].data.ptr);
+		watchers[woken[i]->waiting_descriptor()] = NULL;
+		--waiting;
+	}
+	for (int i=0; i<count; ++i)
+	{
+		resume(woken[i]);
+		++resumed;
+	}
+	return resumed;
+}
+
+void EventLoop::run()
+{
+	while (pending() > 0) run_once(-1);
+}
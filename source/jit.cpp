@@ -0,0 +1,1051 @@
+#include "jit.hpp"
+#include "instructions.hpp"
+
+#include <vector>
+#include <exception>
+#include <cstring>
+#include <climits>
+#include <cstddef>
+#include <algorithm>
+
+#include <sys/mman.h>
+
+
+/*
+	Generated code is one function per block:
+
+		int native(RuntimeMachine *meta, void *entry, ExecutionLimits *limits)
+
+	The prologue saves the callee-saved registers, keeps meta in rbx and
+	limits in rbp, and jumps to entry. The function returns the index of the
+	cell the interpreter must run next, or -(index + 1) when the instruction at
+	index raised an exception that is waiting in pending_exception.
+*/
+typedef int (*NativeFunction)(RuntimeMachine*, void*, ExecutionLimits*);
+
+struct NativeCode
+{
+	void *memory;
+	size_t length;
+	NativeFunction function;
+	/* indexed by cell; NULL where native code cannot be entered */
+	std::vector<void*> entries;
+};
+
+
+/* runtime helpers called from generated code */
+
+static thread_local std::exception_ptr pending_exception;
+
+/*
+	Generated frames have no unwind info, so nothing may throw through them:
+	helpers that can fail park the exception in pending_exception and return
+	1 for the generated code to leave through a stub.
+*/
+static int jit_push(RuntimeMachine *meta, Cell value)
+{
+	try
+	{
+		meta->push_argument(value);
+		return 0;
+	}
+	catch (...)
+	{
+		pending_exception = std::current_exception();
+		return 1;
+	}
+}
+
+static int jit_push_int32(RuntimeMachine *meta, int value)
+{
+	return jit_push(meta, Cell(value));
+}
+
+static int jit_push_cell(RuntimeMachine *meta, const Cell *cell)
+{
+	return jit_push(meta, *cell);
+}
+
+/* the popped value zero-extended, or -1 if the top of the stack is not an INT32 */
+static long long jit_pop_int32(RuntimeMachine *meta)
+{
+	int value;
+	if (!meta->try_pop_int32(&value)) return -1;
+	return static_cast<long long>(static_cast<unsigned int>(value));
+}
+
+static int jit_call_instruction(RuntimeMachine *meta, Instruction inst)
+{
+	try
+	{
+		inst(meta);
+		return 0;
+	}
+	catch (...)
+	{
+		pending_exception = std::current_exception();
+		return 1;
+	}
+}
+
+/* 1 if the machine has just been suspended */
+static int jit_check_limits(RuntimeMachine *meta)
+{
+	return meta->check_limits() ? 1 : 0;
+}
+
+
+/* instruction classes */
+
+enum OpKind
+{
+	KIND_IMMEDIATE,		// load_immediate
+	KIND_STACK,			// duplicate, drop, swap, over
+	KIND_ARITHMETIC,		// int32 add, subtract, multiply
+	KIND_DIVIDE,			// int32 divide, modulo
+	KIND_NEGATE,			// negate_int32
+	KIND_COMPARE,			// int32 comparisons
+	KIND_JUMP,			// jump_relative
+	KIND_BRANCH,			// jump_if_zero, jump_if_nonzero
+	KIND_GENERIC,			// called through jit_call_instruction
+	KIND_BAIL				// handed back to the interpreter
+};
+
+/* condition codes */
+enum { CC_O = 0x0, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+/*
+	Instructions that take no immediates, never touch the return stack and
+	never suspend can be called directly from native code.
+*/
+static bool is_generic(Opcode op)
+{
+	const InstructionInfo &info = instruction_table[op];
+	return info.immediates == 0 && (info.flags & (INSTRUCTION_TERMINATES | INSTRUCTION_CALL | INSTRUCTION_SUSPENDS)) == 0;
+}
+
+struct Op
+{
+	unsigned int index;
+	unsigned int width;
+	OpKind kind;
+	Opcode opcode;
+	Instruction instruction;
+	int immediate;
+	unsigned int target;
+};
+
+/*
+	Splits a block into instructions. Decoding stops at anything whose width
+	cannot be known statically; the interpreter handles the rest of the block.
+*/
+static void decode_block(const CodeBlock *block, std::vector<Op> &ops)
+{
+	unsigned int index = 0;
+	while (index < block->size)
+	{
+		const Cell &cell = block->text[index];
+		Op op;
+		op.index = index;
+		op.width = 1;
+		op.kind = KIND_BAIL;
+		op.opcode = OPCODE_COUNT;
+		op.instruction = NULL;
+		op.immediate = 0;
+		op.target = 0;
+
+		if (cell.type != INSTRUCTION)
+		{
+			/* procedure calls, word lookups and illegal cells */
+			ops.push_back(op);
+			index += 1;
+			continue;
+		}
+
+		if (cell.opcode >= OPCODE_COUNT) break;
+		unsigned int width = instruction_width(block, index);
+		if (width == 0) break;
+
+		Opcode code = cell.opcode;
+		const InstructionInfo &info = instruction_table[code];
+		op.opcode = code;
+		op.instruction = info.function;
+		op.width = width;
+
+		switch (code)
+		{
+			case OP_load_immediate:
+				op.kind = KIND_IMMEDIATE;
+				break;
+			case OP_duplicate: case OP_drop: case OP_swap: case OP_over:
+				op.kind = KIND_STACK;
+				break;
+			case OP_add_int32: case OP_subtract_int32: case OP_multiply_int32:
+				op.kind = KIND_ARITHMETIC;
+				break;
+			case OP_divide_int32: case OP_modulo_int32:
+				op.kind = KIND_DIVIDE;
+				break;
+			case OP_negate_int32:
+				op.kind = KIND_NEGATE;
+				break;
+			case OP_equal_int32: case OP_not_equal_int32: case OP_less_int32:
+			case OP_less_equal_int32: case OP_greater_int32: case OP_greater_equal_int32:
+				op.kind = KIND_COMPARE;
+				break;
+			default:
+				if (info.flags & INSTRUCTION_BRANCH)
+				{
+					const Cell &operand = block->text[index + 1];
+					if (operand.type != INT32) break;
+					op.immediate = operand.int32;
+					long long target = static_cast<long long>(index) + 2 + operand.int32;
+					if (target >= 0 && target < block->size)
+					{
+						op.kind = (info.flags & INSTRUCTION_CONDITIONAL) ? KIND_BRANCH : KIND_JUMP;
+						op.target = static_cast<unsigned int>(target);
+					}
+				}
+				else if (is_generic(code))
+				{
+					op.kind = KIND_GENERIC;
+				}
+				break;
+		}
+		if (code == OP_load_immediate && block->text[index + 1].type == INT32)
+		{
+			op.immediate = block->text[index + 1].int32;
+		}
+		ops.push_back(op);
+		index += op.width;
+	}
+}
+
+
+/* x86-64 encoder */
+
+enum Register { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+	R12 = 12, R13 = 13, R14 = 14, R15 = 15 };
+
+struct Assembler
+{
+	std::vector<unsigned char> code;
+
+	unsigned int here() const { return code.size(); }
+	void byte(unsigned int b) { code.push_back(static_cast<unsigned char>(b)); }
+	void imm32(unsigned int v)
+	{
+		for (int i=0; i<4; ++i) byte((v >> (8 * i)) & 0xFF);
+	}
+	void imm64(unsigned long long v)
+	{
+		for (int i=0; i<8; ++i) byte(static_cast<unsigned int>((v >> (8 * i)) & 0xFF));
+	}
+	void rex(bool w, int reg, int rm)
+	{
+		unsigned int prefix = 0x40 | (w ? 8 : 0) | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0);
+		if (prefix != 0x40) byte(prefix);
+	}
+	void modrm(int reg, int rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+	void push(int r) { if (r >= 8) byte(0x41); byte(0x50 + (r & 7)); }
+	void pop(int r) { if (r >= 8) byte(0x41); byte(0x58 + (r & 7)); }
+	void ret() { byte(0xC3); }
+
+	void mov_imm32(int r, int v)
+	{
+		if (r >= 8) byte(0x41);
+		byte(0xB8 + (r & 7));
+		imm32(static_cast<unsigned int>(v));
+	}
+	void mov_imm64(int r, const void *p)
+	{
+		byte(0x48 | (r >= 8 ? 1 : 0));
+		byte(0xB8 + (r & 7));
+		imm64(reinterpret_cast<unsigned long long>(p));
+	}
+	void mov32(int dst, int src) { rex(false, src, dst); byte(0x89); modrm(src, dst); }
+	void mov64(int dst, int src) { rex(true, src, dst); byte(0x89); modrm(src, dst); }
+	void add32(int dst, int src) { rex(false, src, dst); byte(0x01); modrm(src, dst); }
+	void sub32(int dst, int src) { rex(false, src, dst); byte(0x29); modrm(src, dst); }
+	void cmp32(int dst, int src) { rex(false, src, dst); byte(0x39); modrm(src, dst); }
+	void test32(int dst, int src) { rex(false, src, dst); byte(0x85); modrm(src, dst); }
+	void imul32(int dst, int src) { rex(false, dst, src); byte(0x0F); byte(0xAF); modrm(dst, src); }
+	void neg32(int r) { rex(false, 0, r); byte(0xF7); modrm(3, r); }
+	/* edx:eax / r, sign-extending eax first */
+	void idiv32(int r) { byte(0x99); rex(false, 0, r); byte(0xF7); modrm(7, r); }
+	void cmp32_minus_one(int r) { rex(false, 0, r); byte(0x83); modrm(7, r); byte(0xFF); }
+	void cmp_rax_minus_one() { byte(0x48); byte(0x83); byte(0xF8); byte(0xFF); }
+	void test_eax() { byte(0x85); byte(0xC0); }
+	void setcc_eax(int cc) { byte(0x0F); byte(0x90 + cc); byte(0xC0); byte(0x0F); byte(0xB6); byte(0xC0); }
+	void jmp_rsi() { byte(0xFF); byte(0xE6); }
+	void sub_rsp_8() { byte(0x48); byte(0x83); byte(0xEC); byte(0x08); }
+	void add_rsp_8() { byte(0x48); byte(0x83); byte(0xC4); byte(0x08); }
+	/* dec qword [rbp + disp] */
+	void dec64_rbp(unsigned int disp) { byte(0x48); byte(0xFF); byte(0x4D); byte(disp); }
+	/* cmp dword [rbp + disp], 0 */
+	void cmp32_rbp_zero(unsigned int disp) { byte(0x83); byte(0x7D); byte(disp); byte(0x00); }
+	void call(const void *fn) { mov_imm64(RAX, fn); byte(0xFF); byte(0xD0); }
+
+	/* return the offset of the rel32 field for patching */
+	unsigned int jmp() { byte(0xE9); imm32(0); return here() - 4; }
+	unsigned int jcc(int cc) { byte(0x0F); byte(0x80 + cc); imm32(0); return here() - 4; }
+	void patch(unsigned int field, unsigned int target)
+	{
+		unsigned int rel = target - (field + 4);
+		memcpy(&code[field], &rel, 4);
+	}
+};
+
+
+/* compiler: a virtual operand stack of int32 constants and registers above the real stack */
+
+struct Value
+{
+	bool constant;
+	int value;
+	int reg;
+};
+
+struct Stub
+{
+	std::vector<unsigned int> fields;
+	std::vector<Value> stack;
+	int result;
+};
+
+struct Fixup
+{
+	unsigned int field;
+	unsigned int target;
+};
+
+/* slow path of a backedge check, holding the virtual stack the target expects */
+struct Safepoint
+{
+	std::vector<unsigned int> fields;
+	std::vector<Value> stack;
+	unsigned int target;
+};
+
+static const int value_registers[] = { R12, R13, R14, R15 };
+static const unsigned int register_count = 4;
+/* values a jump target keeps in registers; one more is left for a branch condition */
+static const unsigned int max_label_depth = register_count - 1;
+
+class Compiler
+{
+	const CodeBlock *block;
+	Assembler a;
+	std::vector<Value> stack;
+	bool used[16];
+	std::vector<Stub> stubs;
+	std::vector<Fixup> fixups;
+	std::vector<Safepoint> safepoints;
+	std::vector<unsigned int> epilogue_jumps;
+	/* per jump target, how many values arrive in registers; -1 until the first edge to it is compiled */
+	std::vector<int> depths;
+	/* false after an unconditional exit, until the next jump target */
+	bool reachable;
+
+	public:
+	std::vector<int> labels;
+	std::vector<int> entries;
+
+	Compiler(const CodeBlock *b) : block(b), depths(b->size, -1), reachable(true), labels(b->size, -1), entries(b->size, -1)
+	{
+		memset(used, 0, sizeof(used));
+	}
+
+	const std::vector<unsigned char> &code() const { return a.code; }
+
+	unsigned int free_registers() const
+	{
+		unsigned int count = 0;
+		for (unsigned int i=0; i<register_count; ++i) if (!used[value_registers[i]]) ++count;
+		return count;
+	}
+
+	int allocate()
+	{
+		for (unsigned int i=0; i<register_count; ++i)
+		{
+			if (!used[value_registers[i]])
+			{
+				used[value_registers[i]] = true;
+				return value_registers[i];
+			}
+		}
+		return -1;
+	}
+
+	Value take()
+	{
+		Value v = stack.back();
+		stack.pop_back();
+		if (!v.constant) used[v.reg] = false;
+		return v;
+	}
+
+	void push_constant(int value)
+	{
+		Value v = { true, value, -1 };
+		stack.push_back(v);
+	}
+
+	void push_register(int reg)
+	{
+		Value v = { false, 0, reg };
+		stack.push_back(v);
+	}
+
+	/* emit pushes of a virtual stack onto the real one, bottom first; a failed push raises at index */
+	void emit_flush(const std::vector<Value> &values, unsigned int index)
+	{
+		if (values.empty()) return;
+		unsigned int failure = stubs.size();
+		stub(std::vector<Value>(), -static_cast<int>(index) - 1);
+		for (unsigned int i=0; i<values.size(); ++i)
+		{
+			a.mov64(RDI, RBX);
+			if (values[i].constant) a.mov_imm32(RSI, values[i].value);
+			else a.mov32(RSI, values[i].reg);
+			a.call(reinterpret_cast<const void*>(jit_push_int32));
+			a.test_eax();
+			stubs[failure].fields.push_back(a.jcc(CC_NE));
+		}
+	}
+
+	void flush(unsigned int index)
+	{
+		emit_flush(stack, index);
+		stack.clear();
+		memset(used, 0, sizeof(used));
+	}
+
+	/* forget the virtual stack without emitting anything, e.g. where control cannot fall through */
+	void discard()
+	{
+		stack.clear();
+		memset(used, 0, sizeof(used));
+	}
+
+	/*
+		Jump targets keep the top of the stack in registers, so loops do not
+		spill it to the real stack on every iteration. A target expects its
+		depth values in value_registers[0], [1], ... bottom first, and anything
+		deeper on the real stack; the first edge compiled to it fixes the
+		depth. conform brings the virtual stack into that shape, leaving the
+		top above values in the registers after them. Popping missing values
+		can fail on a non-int32, which hands the instruction at index to the
+		interpreter.
+	*/
+	void conform(unsigned int target, unsigned int index, unsigned int above)
+	{
+		unsigned int below = stack.size() > above ? stack.size() - above : 0;
+		if (depths[target] < 0) depths[target] = static_cast<int>(std::min(below, max_label_depth));
+		unsigned int depth = static_cast<unsigned int>(depths[target]);
+
+		if (below > depth)
+		{
+			std::vector<Value> spilled(stack.begin(), stack.begin() + (below - depth));
+			emit_flush(spilled, index);
+			stack.erase(stack.begin(), stack.begin() + (below - depth));
+			for (unsigned int i=0; i<spilled.size(); ++i) if (!spilled[i].constant) used[spilled[i].reg] = false;
+		}
+		ensure(depth + above, index);
+		arrange(depth);
+	}
+
+	/*
+		Parallel move of the virtual stack into value_registers in order.
+		Constants are materialised except in the top slots above depth, and
+		a cycle of registers is broken through eax.
+	*/
+	void arrange(unsigned int depth)
+	{
+		unsigned int count = stack.size();
+		std::vector<int> from(count), to(count);
+		std::vector<bool> done(count);
+		for (unsigned int i=0; i<count; ++i)
+		{
+			from[i] = stack[i].constant ? -1 : stack[i].reg;
+			to[i] = value_registers[i];
+			done[i] = from[i] == to[i] || (stack[i].constant && i >= depth);
+		}
+
+		for (;;)
+		{
+			int pending = -1;
+			bool moved = false;
+			for (unsigned int i=0; i<count; ++i)
+			{
+				if (done[i] || from[i] < 0) continue;
+				pending = i;
+				bool blocked = false;
+				for (unsigned int j=0; j<count; ++j)
+				{
+					if (j != i && !done[j] && from[j] == to[i]) blocked = true;
+				}
+				if (blocked) continue;
+				a.mov32(to[i], from[i]);
+				done[i] = true;
+				moved = true;
+			}
+			if (pending < 0) break;
+			if (!moved)
+			{
+				a.mov32(RAX, from[pending]);
+				from[pending] = RAX;
+			}
+		}
+		for (unsigned int i=0; i<count; ++i)
+		{
+			if (!done[i]) a.mov_imm32(to[i], stack[i].value);
+		}
+
+		memset(used, 0, sizeof(used));
+		for (unsigned int i=0; i<count; ++i)
+		{
+			if (stack[i].constant && i >= depth) continue;
+			stack[i].constant = false;
+			stack[i].reg = to[i];
+			used[to[i]] = true;
+		}
+	}
+
+	/* the virtual stack a target expects, for code only reached by jumping there */
+	void adopt(unsigned int target)
+	{
+		if (depths[target] < 0) depths[target] = 0;
+		discard();
+		for (int i=0; i<depths[target]; ++i)
+		{
+			push_register(value_registers[i]);
+			used[value_registers[i]] = true;
+		}
+	}
+
+	void emit_return(int result)
+	{
+		a.mov_imm32(RAX, result);
+		epilogue_jumps.push_back(a.jmp());
+	}
+
+	/* out-of-line exit that restores the given virtual stack before returning */
+	Stub &stub(const std::vector<Value> &values, int result)
+	{
+		Stub s;
+		s.stack = values;
+		s.result = result;
+		stubs.push_back(s);
+		return stubs.back();
+	}
+
+	/*
+		Make sure the top n values are virtual, popping int32s off the real
+		stack into registers. A non-int32 leaves through a stub that hands
+		the instruction to the interpreter.
+	*/
+	void ensure(unsigned int n, unsigned int index)
+	{
+		if (stack.size() >= n) return;
+		if (free_registers() < n - stack.size()) flush(index);
+		while (stack.size() < n)
+		{
+			a.mov64(RDI, RBX);
+			a.call(reinterpret_cast<const void*>(jit_pop_int32));
+			a.cmp_rax_minus_one();
+			stub(stack, static_cast<int>(index)).fields.push_back(a.jcc(CC_E));
+			int reg = allocate();
+			a.mov32(reg, RAX);
+			Value v = { false, 0, reg };
+			stack.insert(stack.begin(), v);
+		}
+	}
+
+	void load(int reg, const Value &v)
+	{
+		if (v.constant) a.mov_imm32(reg, v.value);
+		else a.mov32(reg, v.reg);
+	}
+
+	/* rhs as a register operand, materialising constants in ecx */
+	int operand(const Value &v)
+	{
+		if (!v.constant) return v.reg;
+		a.mov_imm32(RCX, v.value);
+		return RCX;
+	}
+
+	void emit_stack(const Op &op)
+	{
+		Opcode code = op.opcode;
+		unsigned int needed = code == OP_drop || code == OP_duplicate ? 1 : 2;
+		unsigned int extra = code == OP_duplicate || code == OP_over ? 1 : 0;
+		if (stack.size() < needed && free_registers() >= needed - stack.size() + extra) ensure(needed, op.index);
+		if (stack.size() < needed || free_registers() < extra)
+		{
+			emit_generic(op);
+			return;
+		}
+		if (code == OP_drop)
+		{
+			take();
+		}
+		else if (code == OP_swap)
+		{
+			Value top = stack[stack.size() - 1];
+			stack[stack.size() - 1] = stack[stack.size() - 2];
+			stack[stack.size() - 2] = top;
+		}
+		else
+		{
+			Value source = code == OP_duplicate ? stack[stack.size() - 1] : stack[stack.size() - 2];
+			if (source.constant)
+			{
+				push_constant(source.value);
+			}
+			else
+			{
+				int reg = allocate();
+				a.mov32(reg, source.reg);
+				push_register(reg);
+			}
+		}
+	}
+
+	static bool fold(Opcode code, int lhs, int rhs, int *result)
+	{
+		switch (code)
+		{
+			case OP_add_int32: return !__builtin_add_overflow(lhs, rhs, result);
+			case OP_subtract_int32: return !__builtin_sub_overflow(lhs, rhs, result);
+			case OP_multiply_int32: return !__builtin_mul_overflow(lhs, rhs, result);
+			case OP_equal_int32: *result = lhs == rhs; break;
+			case OP_not_equal_int32: *result = lhs != rhs; break;
+			case OP_less_int32: *result = lhs < rhs; break;
+			case OP_less_equal_int32: *result = lhs <= rhs; break;
+			case OP_greater_int32: *result = lhs > rhs; break;
+			default: *result = lhs >= rhs; break;
+		}
+		return true;
+	}
+
+	static int condition(Opcode code)
+	{
+		switch (code)
+		{
+			case OP_equal_int32: return CC_E;
+			case OP_not_equal_int32: return CC_NE;
+			case OP_less_int32: return CC_L;
+			case OP_less_equal_int32: return CC_LE;
+			case OP_greater_int32: return CC_G;
+			default: return CC_GE;
+		}
+	}
+
+	/* operands are popped into registers by ensure; the result reuses one of theirs */
+	void emit_binary(const Op &op)
+	{
+		ensure(2, op.index);
+		Value rhs = stack[stack.size() - 1];
+		Value lhs = stack[stack.size() - 2];
+		Opcode code = op.opcode;
+
+		if (lhs.constant && rhs.constant)
+		{
+			int result;
+			if (!fold(code, lhs.value, rhs.value, &result))
+			{
+				/* overflow: let the interpreter raise it */
+				emit_bail(op);
+				return;
+			}
+			take();
+			take();
+			push_constant(result);
+			return;
+		}
+
+		load(RAX, lhs);
+		int r = operand(rhs);
+		if (op.kind == KIND_ARITHMETIC)
+		{
+			if (code == OP_add_int32) a.add32(RAX, r);
+			else if (code == OP_subtract_int32) a.sub32(RAX, r);
+			else a.imul32(RAX, r);
+			/* operands are still intact, so the interpreter can redo the instruction and raise */
+			stub(stack, static_cast<int>(op.index)).fields.push_back(a.jcc(CC_O));
+		}
+		else
+		{
+			a.cmp32(RAX, r);
+			a.setcc_eax(condition(code));
+		}
+		take();
+		take();
+		int reg = allocate();
+		a.mov32(reg, RAX);
+		push_register(reg);
+	}
+
+	/* zero divisors and MIN / -1 are left to the interpreter, which raises or special-cases them */
+	void emit_divide(const Op &op)
+	{
+		ensure(2, op.index);
+		Value rhs = stack[stack.size() - 1];
+		Value lhs = stack[stack.size() - 2];
+		bool modulo = op.opcode == OP_modulo_int32;
+
+		if (rhs.constant && (rhs.value == 0 || rhs.value == -1))
+		{
+			emit_bail(op);
+			return;
+		}
+		if (lhs.constant && rhs.constant)
+		{
+			take();
+			take();
+			push_constant(modulo ? lhs.value % rhs.value : lhs.value / rhs.value);
+			return;
+		}
+
+		load(RAX, lhs);
+		int r = operand(rhs);
+		if (!rhs.constant)
+		{
+			a.test32(r, r);
+			stub(stack, static_cast<int>(op.index)).fields.push_back(a.jcc(CC_E));
+			a.cmp32_minus_one(r);
+			stub(stack, static_cast<int>(op.index)).fields.push_back(a.jcc(CC_E));
+		}
+		a.idiv32(r);
+		take();
+		take();
+		int reg = allocate();
+		a.mov32(reg, modulo ? RDX : RAX);
+		push_register(reg);
+	}
+
+	void emit_negate(const Op &op)
+	{
+		ensure(1, op.index);
+		Value v = stack.back();
+		if (v.constant)
+		{
+			if (v.value == INT_MIN)
+			{
+				emit_bail(op);
+				return;
+			}
+			take();
+			push_constant(-v.value);
+			return;
+		}
+		a.mov32(RAX, v.reg);
+		a.neg32(RAX);
+		stub(stack, static_cast<int>(op.index)).fields.push_back(a.jcc(CC_O));
+		take();
+		int reg = allocate();
+		a.mov32(reg, RAX);
+		push_register(reg);
+	}
+
+	/* as RuntimeMachine::at_safepoint: spend one unit of fuel, leave if it ran out or a limit is pending */
+	void emit_safepoint(unsigned int target)
+	{
+		Safepoint s;
+		s.target = target;
+		s.stack = stack;
+		a.dec64_rbp(offsetof(ExecutionLimits, fuel));
+		s.fields.push_back(a.jcc(CC_L));
+		a.cmp32_rbp_zero(offsetof(ExecutionLimits, pending));
+		s.fields.push_back(a.jcc(CC_NE));
+		safepoints.push_back(s);
+	}
+
+	void emit_jump_to(unsigned int target, const Op &op)
+	{
+		if (target <= op.index) emit_safepoint(target);
+		Fixup f = { a.jmp(), target };
+		fixups.push_back(f);
+	}
+
+	/* both edges leave with the stack the target expects */
+	void emit_branch(const Op &op)
+	{
+		conform(op.target, op.index, 1);
+		Value condition_value = take();
+		bool on_zero = op.opcode == OP_jump_if_zero;
+		if (condition_value.constant)
+		{
+			if ((condition_value.value == 0) == on_zero)
+			{
+				emit_jump_to(op.target, op);
+				reachable = false;
+			}
+			return;
+		}
+		a.test32(condition_value.reg, condition_value.reg);
+		if (op.target <= op.index)
+		{
+			/* backward: only the taken edge pays for the check */
+			unsigned int skip = a.jcc(on_zero ? CC_NE : CC_E);
+			emit_jump_to(op.target, op);
+			a.patch(skip, a.here());
+			return;
+		}
+		Fixup f = { a.jcc(on_zero ? CC_E : CC_NE), op.target };
+		fixups.push_back(f);
+	}
+
+	void emit_generic(const Op &op)
+	{
+		flush(op.index);
+		a.mov64(RDI, RBX);
+		a.mov_imm64(RSI, reinterpret_cast<const void*>(op.instruction));
+		a.call(reinterpret_cast<const void*>(jit_call_instruction));
+		a.test_eax();
+		std::vector<Value> empty;
+		stub(empty, -static_cast<int>(op.index) - 1).fields.push_back(a.jcc(CC_NE));
+	}
+
+	void emit_bail(const Op &op)
+	{
+		flush(op.index);
+		emit_return(static_cast<int>(op.index));
+		reachable = false;
+	}
+
+	void compile(const std::vector<Op> &ops)
+	{
+		/* prologue: six pushes and a pad leave rsp 16-byte aligned for helper calls */
+		a.push(RBX);
+		a.push(RBP);
+		a.push(R12);
+		a.push(R13);
+		a.push(R14);
+		a.push(R15);
+		a.sub_rsp_8();
+		a.mov64(RBX, RDI);
+		a.mov64(RBP, RDX);
+		a.jmp_rsi();
+
+		std::vector<bool> is_target(block->size, false);
+		for (unsigned int i=0; i<ops.size(); ++i)
+		{
+			if (ops[i].kind == KIND_JUMP || ops[i].kind == KIND_BRANCH) is_target[ops[i].target] = true;
+		}
+
+		std::vector<unsigned int> trampolines;
+		for (unsigned int i=0; i<ops.size(); ++i)
+		{
+			const Op &op = ops[i];
+			if (is_target[op.index])
+			{
+				if (reachable) conform(op.index, op.index, 0);
+				else adopt(op.index);
+			}
+			else if (!reachable) discard();
+			reachable = true;
+
+			labels[op.index] = a.here();
+			if (op.kind != KIND_BAIL)
+			{
+				if (stack.empty()) entries[op.index] = a.here();
+				else if (is_target[op.index]) trampolines.push_back(op.index);
+			}
+
+			switch (op.kind)
+			{
+				case KIND_IMMEDIATE: {
+					const Cell *value = &block->text[op.index + 1];
+					if (value->type == INT32)
+					{
+						push_constant(value->int32);
+					}
+					else
+					{
+						flush(op.index);
+						a.mov64(RDI, RBX);
+						a.mov_imm64(RSI, value);
+						a.call(reinterpret_cast<const void*>(jit_push_cell));
+						a.test_eax();
+						stub(std::vector<Value>(), -static_cast<int>(op.index) - 1).fields.push_back(a.jcc(CC_NE));
+					}
+					break;
+				}
+				case KIND_STACK: emit_stack(op); break;
+				case KIND_ARITHMETIC:
+				case KIND_COMPARE: emit_binary(op); break;
+				case KIND_DIVIDE: emit_divide(op); break;
+				case KIND_NEGATE: emit_negate(op); break;
+				case KIND_JUMP:
+					conform(op.target, op.index, 0);
+					emit_jump_to(op.target, op);
+					reachable = false;
+					break;
+				case KIND_BRANCH: emit_branch(op); break;
+				case KIND_GENERIC: emit_generic(op); break;
+				case KIND_BAIL: emit_bail(op); break;
+			}
+		}
+
+		/* falling off the decoded region: the interpreter continues from there */
+		unsigned int end = ops.empty() ? 0 : ops.back().index + ops.back().width;
+		if (reachable)
+		{
+			flush(ops.back().index);
+			emit_return(static_cast<int>(end));
+		}
+
+		/* the interpreter enters a target that keeps values in registers by popping them first */
+		for (unsigned int i=0; i<trampolines.size(); ++i)
+		{
+			unsigned int target = trampolines[i];
+			discard();
+			entries[target] = a.here();
+			conform(target, target, 0);
+			Fixup f = { a.jmp(), target };
+			fixups.push_back(f);
+		}
+
+		/* a safepoint either carries on round the loop or suspends at its target */
+		for (unsigned int i=0; i<safepoints.size(); ++i)
+		{
+			Safepoint &s = safepoints[i];
+			for (unsigned int f=0; f<s.fields.size(); ++f) a.patch(s.fields[f], a.here());
+			a.mov64(RDI, RBX);
+			a.call(reinterpret_cast<const void*>(jit_check_limits));
+			a.test_eax();
+			Fixup f = { a.jcc(CC_E), s.target };
+			fixups.push_back(f);
+			emit_flush(s.stack, s.target);
+			emit_return(static_cast<int>(s.target));
+		}
+
+		/* last, since flushing in a stub adds stubs of its own; only hand-back stubs carry values */
+		for (unsigned int i=0; i<stubs.size(); ++i)
+		{
+			Stub s = stubs[i];
+			for (unsigned int f=0; f<s.fields.size(); ++f) a.patch(s.fields[f], a.here());
+			emit_flush(s.stack, static_cast<unsigned int>(s.result));
+			emit_return(s.result);
+		}
+
+		unsigned int epilogue = a.here();
+		a.add_rsp_8();
+		a.pop(R15);
+		a.pop(R14);
+		a.pop(R13);
+		a.pop(R12);
+		a.pop(RBP);
+		a.pop(RBX);
+		a.ret();
+		for (unsigned int i=0; i<epilogue_jumps.size(); ++i) a.patch(epilogue_jumps[i], epilogue);
+
+		for (unsigned int i=0; i<fixups.size(); ++i)
+		{
+			a.patch(fixups[i].field, static_cast<unsigned int>(labels[fixups[i].target]));
+		}
+	}
+};
+
+
+/* ops that call back into the runtime or leave native code each time they run */
+static bool is_slow(const CodeBlock *block, const Op &op)
+{
+	if (op.kind == KIND_GENERIC || op.kind == KIND_BAIL) return true;
+	return op.kind == KIND_IMMEDIATE && block->text[op.index + 1].type != INT32;
+}
+
+NativeCode* jit_compile(const CodeBlock *block)
+{
+	NativeCode *native = new NativeCode;
+	native->memory = NULL;
+	native->length = 0;
+	native->function = NULL;
+	native->entries.assign(block->size, NULL);
+
+	std::vector<Op> ops;
+	decode_block(block, ops);
+
+	/* every jump must land on an instruction boundary inside the decoded region */
+	std::vector<bool> boundary(block->size, false);
+	for (unsigned int i=0; i<ops.size(); ++i) boundary[ops[i].index] = true;
+	for (unsigned int i=0; i<ops.size(); ++i)
+	{
+		if ((ops[i].kind == KIND_JUMP || ops[i].kind == KIND_BRANCH) && !boundary[ops[i].target])
+		{
+			ops[i].kind = KIND_BAIL;
+		}
+	}
+	if (ops.empty()) return native;
+
+	/*
+		A loop with a slow op in it spills its values to the real stack on
+		every iteration and runs slower than the verified interpreter, so
+		such blocks are left to the interpreter.
+	*/
+	for (unsigned int i=0; i<ops.size(); ++i)
+	{
+		if ((ops[i].kind != KIND_JUMP && ops[i].kind != KIND_BRANCH) || ops[i].target > ops[i].index) continue;
+		for (unsigned int j=0; j<ops.size(); ++j)
+		{
+			if (ops[j].index >= ops[i].target && ops[j].index <= ops[i].index && is_slow(block, ops[j])) return native;
+		}
+	}
+
+	Compiler compiler(block);
+	compiler.compile(ops);
+	const std::vector<unsigned char> &code = compiler.code();
+
+	void *memory = mmap(NULL, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) return native;
+	memcpy(memory, &code[0], code.size());
+	if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0)
+	{
+		munmap(memory, code.size());
+		return native;
+	}
+
+	native->memory = memory;
+	native->length = code.size();
+	native->function = reinterpret_cast<NativeFunction>(memory);
+	for (unsigned int i=0; i<block->size; ++i)
+	{
+		if (compiler.entries[i] >= 0) native->entries[i] = static_cast<unsigned char*>(memory) + compiler.entries[i];
+	}
+	return native;
+}
+
+bool jit_can_enter(const NativeCode *native, unsigned int index)
+{
+	return index < native->entries.size() && native->entries[index] != NULL;
+}
+
+void jit_release(NativeCode *native)
+{
+	if (native->memory != NULL) munmap(native->memory, native->length);
+	delete native;
+}
+
+void jit_enter(RuntimeMachine *meta, StackFrame &frame)
+{
+	const CodeBlock *code = frame.code;
+	NativeCode *native = code->native;
+	unsigned int index = static_cast<unsigned int>(frame.location_pointer - code->text);
+	if (index >= native->entries.size() || native->entries[index] == NULL) return;
+
+	int result = native->function(meta, native->entries[index], meta->execution_limits());
+	if (result < 0)
+	{
+		unsigned int fault = static_cast<unsigned int>(-(result + 1));
+		frame.location_pointer = code->text + fault + 1;
+		std::exception_ptr e = pending_exception;
+		pending_exception = std::exception_ptr();
+		std::rethrow_exception(e);
+	}
+	frame.location_pointer = code->text + result;
+}
@@ -7,9 +7,34 @@
 #include <iomanip>
 #include <cstring>
 #include <cstdlib>
+#include <climits>
+#include <new>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <memory>
 
 
-KeyNotFoundException::KeyNotFoundException(std::string msg) : std::runtime_error(msg) {}
+KeyNotFoundException::KeyNotFoundException(Cell k) : std::runtime_error("Could not find key"), key(k) {}
+
+const char *KeyNotFoundException::what() const noexcept
+{
+	if (message.empty())
+	{
+		try
+		{
+			message = "Could not find key \"" + key.toString() + "\"";
+		}
+		catch (...)
+		{
+			return std::runtime_error::what();
+		}
+	}
+	return message.c_str();
+}
 
 ObjectIterator::ObjectIterator(std::list<Cell>::iterator k, std::list<Cell>::iterator v)
 : key(k), value(v) {}
@@ -42,6 +67,7 @@ void Object::setattr(Cell key, Cell value)
 	{
 		if (*(iter.key) == key)
 		{
+			if (journal != NULL) journal->push_back(std::make_pair(*(iter.key), *(iter.value)));
 			*(iter.value) = value;
 			return;
 		}
@@ -56,6 +82,16 @@ unsigned int Object::size()
 	return keys.size();
 }
 
+/* drops the attributes added since the object held count of them */
+void Object::restore_size(unsigned int count)
+{
+	while (keys.size() > count)
+	{
+		keys.pop_front();
+		values.pop_front();
+	}
+}
+
 Cell Object::getattr(Cell key)
 {
 	for (ObjectIterator iter = this->begin(); iter != this->end(); ++iter)
@@ -65,9 +101,7 @@ Cell Object::getattr(Cell key)
 			return *(iter.value);
 		}
 	}
-	std::stringstream output;
-	output << "Could not find key \"" << key.toString() << "\"";
-	throw KeyNotFoundException(output.str());
+	throw KeyNotFoundException(key);
 }
 
 ObjectIterator Object::begin()
@@ -99,26 +133,31 @@ std::string Object::toString()
 
 Object* GarbageCollector::create_object()
 {
+	reserve(sizeof(Object));
 	Object* obj = new Object;
 	#ifdef GC_DEBUG
 	std::cout << "Allocated new Object of size " << sizeof(Object) << " at " << (void*)obj << std::endl;
 	#endif
-	storage[Cell(obj)] = false;
+	track(Cell(obj), sizeof(Object));
 
 	return obj;
 }
 char* GarbageCollector::duplicate_string(const char *other)
 {
+	size_t len = strlen(other) + 1;
+	reserve(len);
 	char *dest = strdup(other);
+	if (dest == NULL) throw std::bad_alloc();
 	#ifdef GC_DEBUG
-	unsigned int len = strlen(dest) + 1;
 	std::cout << "Allocated new string of size " << (sizeof(char) * len) << " at " << (void*)dest << std::endl;
 	#endif
-	storage[Cell(dest)] = false;
+	track(Cell(dest), len);
 	return dest;
 }
 CodeBlock* GarbageCollector::create_procedure(unsigned int length)
 {
+	size_t bytes = sizeof(CodeBlock) + sizeof(Cell) * static_cast<size_t>(length);
+	reserve(bytes);
 	Cell *text = new Cell[length];
 	CodeBlock *result = new CodeBlock(length, text);
 
@@ -127,8 +166,143 @@ CodeBlock* GarbageCollector::create_procedure(unsigned int length)
 	std::cout << "Allocated new CodeBlock of size " << sizeof(CodeBlock) << " at " << (void*)result << std::endl;
 	#endif
 	
-	storage[Cell(result)] = false;	
+	track(Cell(result), bytes);
+
+	return result;
+}
+
+Array* GarbageCollector::create_array(ElementType t, unsigned int length)
+{
+	/* 32-byte alignment lets the AVX kernels stream whole arrays */
+	/* sized before allocating, so a length whose byte count overflows is refused */
+	size_t bytes = Array::byteSize(t, length);
+	reserve(sizeof(Array) + bytes);
+	void *buffer = NULL;
+	if (posix_memalign(&buffer, 32, bytes > 0 ? bytes : 1) != 0) throw std::bad_alloc();
+	memset(buffer, 0, bytes);
+	Array *result = new Array(t, length, static_cast<unsigned char*>(buffer), NULL);
+
+	#ifdef GC_DEBUG
+	std::cout << "Allocated new array buffer of size " << bytes << " at " << buffer << std::endl;
+	std::cout << "Allocated new Array of size " << sizeof(Array) << " at " << (void*)result << std::endl;
+	#endif
+
+	track(Cell(result), sizeof(Array) + bytes);
+	return result;
+}
+Array* GarbageCollector::create_array_slice(Array *parent, unsigned int start, unsigned int length)
+{
+	/* views always point at the owning array, so slices of slices stay one level deep */
+	reserve(sizeof(Array));
+	Array *owner = parent->owner ? parent->owner : parent;
+	unsigned char *data = parent->data + Array::byteSize(parent->element_type, start);
+	Array *result = new Array(parent->element_type, length, data, owner);
+
+	#ifdef GC_DEBUG
+	std::cout << "Allocated new Array view of size " << sizeof(Array) << " at " << (void*)result << std::endl;
+	#endif
+
+	track(Cell(result), sizeof(Array));
+	return result;
+}
+
+static StringBuffer* create_string_buffer(unsigned int capacity)
+{
+	StringBuffer *buffer = new StringBuffer;
+	buffer->data = static_cast<char*>(malloc(capacity > 0 ? capacity : 1));
+	if (buffer->data == NULL)
+	{
+		delete buffer;
+		throw std::bad_alloc();
+	}
+	buffer->used = 0;
+	buffer->capacity = capacity;
+	buffer->references = 0;
+	return buffer;
+}
+
+String* GarbageCollector::create_managed_string(const char *chars, unsigned int length)
+{
+	reserve(sizeof(String) + sizeof(StringBuffer) + length);
+	StringBuffer *buffer = create_string_buffer(length);
+	memcpy(buffer->data, chars, length);
+	buffer->used = length;
+	buffer->references++;
+	String *result = new String(buffer, 0, length);
+
+	#ifdef GC_DEBUG
+	std::cout << "Allocated new string buffer of size " << length << " at " << (void*)buffer->data << std::endl;
+	#endif
 
+	track(Cell(result), sizeof(String) + sizeof(StringBuffer) + buffer->capacity);
+	return result;
+}
+String* GarbageCollector::create_string_slice(String *parent, unsigned int start, unsigned int length)
+{
+	reserve(sizeof(String));
+	parent->buffer->references++;
+	String *result = new String(parent->buffer, parent->offset + start, length);
+
+	#ifdef GC_DEBUG
+	std::cout << "Allocated new String view of size " << sizeof(String) << " at " << (void*)result << std::endl;
+	#endif
+
+	track(Cell(result), sizeof(String));
+	return result;
+}
+/*
+	When lhs ends exactly where its buffer's used region ends, rhs is appended
+	into the spare capacity and the result shares the buffer: the strings that
+	already view it are unaffected. Otherwise the result gets a new buffer with
+	room to grow, so repeated appends to the newest string are amortised O(1).
+*/
+String* GarbageCollector::create_string_concatenation(String *lhs, String *rhs)
+{
+	size_t total = static_cast<size_t>(lhs->length) + rhs->length;
+	if (total > UINT_MAX) throw ExecutionOutOfBoundsError("String - length too large");
+	unsigned int length = static_cast<unsigned int>(total);
+	StringBuffer *buffer = lhs->buffer;
+	String *result;
+	size_t bytes = sizeof(String);
+	bool append = lhs->offset + lhs->length == buffer->used && buffer->capacity - buffer->used >= rhs->length;
+	/* doubling leaves room to append in place; it stops at what a buffer can index */
+	size_t doubled = total < 8 ? 16 : total * 2;
+	unsigned int capacity = static_cast<unsigned int>(doubled < UINT_MAX ? doubled : UINT_MAX);
+	reserve(append ? bytes : bytes + sizeof(StringBuffer) + capacity);
+	if (append)
+	{
+		memcpy(buffer->data + buffer->used, rhs->data(), rhs->length);
+		buffer->used += rhs->length;
+		buffer->references++;
+		result = new String(buffer, lhs->offset, length);
+	}
+	else
+	{
+		buffer = create_string_buffer(capacity);
+		memcpy(buffer->data, lhs->data(), lhs->length);
+		memcpy(buffer->data + lhs->length, rhs->data(), rhs->length);
+		buffer->used = length;
+		buffer->references++;
+		result = new String(buffer, 0, length);
+		bytes += sizeof(StringBuffer) + buffer->capacity;
+
+		#ifdef GC_DEBUG
+		std::cout << "Allocated new string buffer of size " << buffer->capacity << " at " << (void*)buffer->data << std::endl;
+		#endif
+	}
+	track(Cell(result), bytes);
+	return result;
+}
+
+Error* GarbageCollector::create_error(ErrorKind kind, Cell value, std::exception_ptr cause)
+{
+	Error *result = new Error(kind, value, cause);
+
+	#ifdef GC_DEBUG
+	std::cout << "Allocated new Error at " << (void*)result << std::endl;
+	#endif
+
+	track(Cell(result), sizeof(Error));
 	return result;
 }
 
@@ -138,14 +312,163 @@ void gc_CellTypeException(CellType t)
 	output << "Illegal operand type from GarbageCollector::sweep - expected " <<
 		Cell::typeAsString(OBJECT) << " or " << 
 		Cell::typeAsString(ZSTRING) << " or " << 
-		Cell::typeAsString(PROCEDURE) <<
+		Cell::typeAsString(PROCEDURE) << " or " <<
+		Cell::typeAsString(ARRAY) << " or " <<
+		Cell::typeAsString(STRING) << " or " <<
+		Cell::typeAsString(ERROR) <<
 		" but received " << Cell::typeAsString(t);
 	throw CellTypeException(output.str());
 }
+/* frees the payload of a managed cell and returns the bytes it was charged for */
+static size_t release(Cell c)
+{
+	size_t bytes = 0;
+	switch (c.type)
+	{
+		case ZSTRING: {
+			
+			#ifdef GC_DEBUG
+			std::cout << "Collecting char* at " << (void*)c.string << std::endl;
+			#endif
+			bytes = strlen(c.string) + 1;
+			free(c.string);
+			break;
+		}
+		case PROCEDURE: {
+			CodeBlock *block = c.procedure;
+			#ifdef GC_DEBUG
+			std::cout << "Collecting Cell* at " << (void*)block->text << std::endl;
+			std::cout << "Collecting CodeBlock at " << (void*)block << std::endl;
+			#endif
+			bytes = sizeof(CodeBlock) + sizeof(Cell) * block->size;
+			delete [] block->text;
+			delete block;
+			break;
+		}
+		case OBJECT: {
+			#ifdef GC_DEBUG
+			std::cout << "Collecting Object at " << (void*)c.object << std::endl;
+			#endif
+			bytes = sizeof(Object);
+			delete c.object;
+			break;
+		}
+		case ARRAY: {
+			Array *arr = c.array;
+			#ifdef GC_DEBUG
+			std::cout << "Collecting Array at " << (void*)arr << std::endl;
+			#endif
+			bytes = sizeof(Array);
+			if (arr->owner == NULL)
+			{
+				bytes += Array::byteSize(arr->element_type, arr->length);
+				free(arr->data);
+			}
+			delete arr;
+			break;
+		}
+		case STRING: {
+			StringBuffer *buffer = c.str->buffer;
+			#ifdef GC_DEBUG
+			std::cout << "Collecting String at " << (void*)c.str << std::endl;
+			#endif
+			bytes = sizeof(String);
+			if (--buffer->references == 0)
+			{
+				bytes += sizeof(StringBuffer) + buffer->capacity;
+				free(buffer->data);
+				delete buffer;
+			}
+			delete c.str;
+			break;
+		}
+		case ERROR: {
+			#ifdef GC_DEBUG
+			std::cout << "Collecting Error at " << (void*)c.error << std::endl;
+			#endif
+			bytes = sizeof(Error);
+			delete c.error;
+			break;
+		}
+		default: gc_CellTypeException(c.type); break;
+	}
+	return bytes;
+}
+
+GarbageCollector::GarbageCollector()
+: marker_threads(1), heap_bytes(0), heap_limit(0), limit_signal(NULL), arena_active(false),
+  stats(), marked_cells(0), collection_callback(NULL), collection_data(NULL) {}
+
+/* the machine is gone, so nothing it allocated can be reachable */
+GarbageCollector::~GarbageCollector()
+{
+	end_arena();
+	for (Storage::iterator iter=storage.begin(); iter!=storage.end(); ++iter)
+	{
+		release(iter->first);
+	}
+}
+
+/*
+	The limit stays soft for a program that creeps past it: the allocation
+	that crosses it goes ahead, and the machine suspends at its next
+	safepoint. What would take the heap far past it is refused before
+	anything is allocated: a request bigger than the whole limit, and any
+	request made after the heap has crossed it. Error values are exempt,
+	so the refusal itself can still be raised to bytecode.
+*/
+void GarbageCollector::reserve(size_t bytes) const
+{
+	if (heap_limit == 0) return;
+	if (heap_bytes <= heap_limit && bytes <= heap_limit - heap_bytes) return;
+	if (bytes <= heap_limit && heap_bytes <= heap_limit) return;
+
+	std::stringstream message;
+	message << "Heap limit of " << heap_limit << " bytes refuses " << bytes << " more with " << heap_bytes << " in use";
+	throw HeapLimitError(message.str());
+}
+
+void GarbageCollector::track(Cell c, size_t bytes)
+{
+	if (arena_active)
+	{
+		arena.push_back(c);
+		arena_members.insert(c.address);
+		stats.arena_allocated++;
+	}
+	else storage[c] = false;
+
+	TypeStatistics &type = stats.types[c.type];
+	type.allocated++;
+	type.allocated_bytes += bytes;
+	heap_bytes += bytes;
+	if (over_heap_limit() && limit_signal != NULL) limit_signal->fetch_or(LIMIT_HEAP, std::memory_order_relaxed);
+}
+
+/*
+	A limit below the current heap signals at once, so the machine suspends
+	at its next safepoint; reserve() decides which allocations are refused.
+*/
+void GarbageCollector::set_heap_limit(size_t limit, std::atomic<int> *signal)
+{
+	heap_limit = limit;
+	limit_signal = signal;
+	if (over_heap_limit() && limit_signal != NULL) limit_signal->fetch_or(LIMIT_HEAP, std::memory_order_relaxed);
+}
+
+void GarbageCollector::dispose(Cell c)
+{
+	size_t bytes = release(c);
+	heap_bytes -= bytes;
+	TypeStatistics &type = stats.types[c.type];
+	type.freed++;
+	type.freed_bytes += bytes;
+}
+
 void GarbageCollector::sweep()
 {
 		// assumes all objects have already been marked
-	std::map<Cell,bool>::iterator iter;
+	Storage::iterator iter;
 	for (iter=storage.begin(); iter!=storage.end();)
 	{
 		if (iter->second)
@@ -155,59 +478,679 @@ void GarbageCollector::sweep()
 		}
 		else
 		{
-			std::map<Cell,bool>::iterator current = iter++;
-			Cell c = current->first;
-			switch (c.type)
+			Storage::iterator current = iter++;
+			dispose(current->first);
+			storage.erase(current);
+		}
+	}
+}
+
+/* cells whose payload lives inside the cell itself are never tracked */
+static bool is_unboxed(CellType t)
+{
+	switch (t)
+	{
+		case INT32:
+		case INT64:
+		case FLOAT64:
+		case INSTRUCTION:
+		case ADDRESS: return true;
+		default: return false;
+	}
+}
+
+/* cells a managed cell refers to directly */
+static void referenced_cells(Cell c, std::vector<Cell> &output)
+{
+	switch (c.type)
+	{
+		case OBJECT:
+			for (ObjectIterator iter = c.object->begin(); iter != c.object->end(); ++iter)
 			{
-				case ZSTRING: {
-					
-					#ifdef GC_DEBUG
-					std::cout << "Collecting char* at " << (void*)c.string << std::endl;
-					#endif
-					free(c.string);
-					break;
-				}
-				case PROCEDURE: {
-					CodeBlock *block = c.procedure;
-					#ifdef GC_DEBUG
-					std::cout << "Collecting Cell* at " << (void*)block->text << std::endl;
-					std::cout << "Collecting CodeBlock at " << (void*)block << std::endl;
-					#endif
-					delete [] block->text;
-					delete block;
-					break;
-				}
-				case OBJECT: {
-					#ifdef GC_DEBUG
-					std::cout << "Collecting Object at " << (void*)c.object << std::endl;
-					#endif
-					delete c.object;
-					break;
-				}
-				default: gc_CellTypeException(c.type); break;
+				output.push_back(*(iter.key));
+				output.push_back(*(iter.value));
 			}
-			storage.erase(current);
+			break;
+		case PROCEDURE:
+			output.insert(output.end(), c.procedure->text, c.procedure->text + c.procedure->size);
+			if (c.procedure->source != NULL) output.push_back(Cell(const_cast<CodeBlock*>(c.procedure->source)));
+			break;
+		case ARRAY:
+			if (c.array->owner != NULL) output.push_back(Cell(c.array->owner));
+			break;
+		case ERROR:
+			output.push_back(c.error->value);
+			break;
+		default:
+			break;
+	}
+}
+
+void GarbageCollector::begin_arena()
+{
+	arena_active = true;
+}
+
+/* frees every arena allocation that was not promoted, without marking or searching anything */
+void GarbageCollector::end_arena()
+{
+	arena_active = false;
+	for (std::vector<Cell>::iterator iter=arena.begin(); iter!=arena.end(); ++iter)
+	{
+		if (!is_unboxed(iter->type)) dispose(*iter);
+	}
+	arena.clear();
+	arena_members.clear();
+}
+
+bool GarbageCollector::in_arena(Cell c) const
+{
+	if (!arena_active || is_unboxed(c.type)) return false;
+	return arena_members.count(c.address) > 0;
+}
+
+bool GarbageCollector::manages(Cell c) const
+{
+	return storage.count(c) > 0 || in_arena(c);
+}
+
+/*
+	Moves every arena allocation reachable from root into the collected heap,
+	so it outlives end_arena. Cost is proportional to the arena plus the
+	graph reachable from root.
+*/
+void GarbageCollector::promote(Cell root)
+{
+	if (arena.empty()) return;
+
+	std::map<Cell, unsigned int, CellIdentityLess> index;
+	for (unsigned int i=0; i<arena.size(); ++i)
+	{
+		if (!is_unboxed(arena[i].type)) index[arena[i]] = i;
+	}
+
+	std::set<Cell, CellIdentityLess> visited;
+	std::vector<Cell> pending(1, root);
+	while (!pending.empty())
+	{
+		Cell c = pending.back();
+		pending.pop_back();
+		if (is_unboxed(c.type) || !visited.insert(c).second) continue;
+
+		std::map<Cell, unsigned int, CellIdentityLess>::iterator found = index.find(c);
+		if (found != index.end())
+		{
+			/* the tombstone is skipped by end_arena */
+			arena[found->second] = Cell();
+			arena_members.erase(c.address);
+			storage[c] = false;
+			stats.promoted++;
 		}
+		referenced_cells(c, pending);
+	}
+}
+
+/* arena allocations live until end_arena, so whatever they refer to does too */
+void GarbageCollector::mark_arena()
+{
+	std::vector<Cell> children;
+	for (std::vector<Cell>::iterator iter=arena.begin(); iter!=arena.end(); ++iter)
+	{
+		if (!is_unboxed(iter->type)) referenced_cells(*iter, children);
 	}
+	for (std::vector<Cell>::iterator iter=children.begin(); iter!=children.end(); ++iter)
+	{
+		mark(*iter);
+	}
+}
+
+/* claims c for marking; false if it is already marked or not collected here */
+static bool set_mark_bit(GarbageCollector::Storage &storage, Cell c)
+{
+	if (is_unboxed(c.type)) return false;
+	GarbageCollector::Storage::iterator found = storage.find(c);
+	if (found == storage.end()) return false;
+	/* the load keeps already marked cells from bouncing their cache line between markers */
+	if (found->second.load(std::memory_order_relaxed)) return false;
+	return !found->second.exchange(true, std::memory_order_acq_rel);
 }
 
+/* an explicit stack, so long chains of references cannot overflow the C++ one */
 void GarbageCollector::mark(Cell c)
 {
-	if (storage.count(c) > 0  && storage[c] == false)
+	std::vector<Cell> pending(1, c);
+	while (!pending.empty())
 	{
-		std::cout << "~marked " << c.toString() << std::endl;
-		storage[c] = true;
-		if (c.type == OBJECT)
+		Cell next = pending.back();
+		pending.pop_back();
+		if (!set_mark_bit(storage, next)) continue;
+		marked_cells++;
+		referenced_cells(next, pending);
+	}
+}
+
+void GarbageCollector::set_marker_threads(unsigned int threads)
+{
+	if (threads == 0) threads = std::thread::hardware_concurrency();
+	marker_threads = threads > 0 ? threads : 1;
+}
+
+
+/*
+	Parallel marking. Each marker works through a private stack and, while
+	it holds plenty of work and its shared stack is empty, moves the older
+	half there for idle markers to steal. Mark bits are claimed with an
+	atomic exchange, so each cell is traced by exactly one marker. A marker
+	only goes idle once it has found every shared stack empty, so when all
+	of them are idle the graph is done.
+*/
+struct MarkStack
+{
+	std::vector<Cell> local;
+	std::mutex lock;
+	std::vector<Cell> shared;
+	std::atomic<size_t> available;		// shared.size(), readable without the lock
+	unsigned long long marked;
+
+	MarkStack() : available(0), marked(0) {}
+};
+
+/* below this many cells a marker keeps its work to itself */
+const size_t MARK_SHARE_THRESHOLD = 64;
+
+class ParallelMarker
+{
+	GarbageCollector::Storage &storage;
+	std::vector<std::unique_ptr<MarkStack> > stacks;
+	std::atomic<unsigned int> idle;
+
+	void share(MarkStack &stack);
+	bool steal(unsigned int self);
+	bool work_left() const;
+	void work(unsigned int self);
+
+	public:
+	ParallelMarker(GarbageCollector::Storage &s, unsigned int threads);
+	/* marks everything reachable from roots; returns the number of cells marked */
+	unsigned long long run(const std::vector<Cell> &roots);
+};
+
+ParallelMarker::ParallelMarker(GarbageCollector::Storage &s, unsigned int threads)
+: storage(s), idle(0)
+{
+	for (unsigned int i=0; i<threads; ++i) stacks.push_back(std::unique_ptr<MarkStack>(new MarkStack));
+}
+
+void ParallelMarker::share(MarkStack &stack)
+{
+	size_t half = stack.local.size() / 2;
+	std::lock_guard<std::mutex> guard(stack.lock);
+	stack.shared.insert(stack.shared.end(), stack.local.begin(), stack.local.begin() + half);
+	stack.local.erase(stack.local.begin(), stack.local.begin() + half);
+	stack.available.store(stack.shared.size());
+}
+
+/* takes half of the first non-empty shared stack, starting with the marker's own */
+bool ParallelMarker::steal(unsigned int self)
+{
+	for (unsigned int i=0; i<stacks.size(); ++i)
+	{
+		MarkStack &victim = *stacks[(self + i) % stacks.size()];
+		if (victim.available.load() == 0) continue;
+
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (victim.shared.empty()) continue;
+		size_t count = (victim.shared.size() + 1) / 2;
+		std::vector<Cell> &local = stacks[self]->local;
+		local.insert(local.end(), victim.shared.end() - count, victim.shared.end());
+		victim.shared.resize(victim.shared.size() - count);
+		victim.available.store(victim.shared.size());
+		return true;
+	}
+	return false;
+}
+
+bool ParallelMarker::work_left() const
+{
+	for (unsigned int i=0; i<stacks.size(); ++i)
+	{
+		if (stacks[i]->available.load() > 0) return true;
+	}
+	return false;
+}
+
+void ParallelMarker::work(unsigned int self)
+{
+	MarkStack &stack = *stacks[self];
+	for (;;)
+	{
+		while (!stack.local.empty())
 		{
-			for (ObjectIterator iter = c.object->begin(); iter != c.object->end(); ++iter)
+			Cell next = stack.local.back();
+			stack.local.pop_back();
+			if (!set_mark_bit(storage, next)) continue;
+			stack.marked++;
+			referenced_cells(next, stack.local);
+			if (stack.local.size() >= MARK_SHARE_THRESHOLD && stack.available.load(std::memory_order_relaxed) == 0) share(stack);
+		}
+		if (steal(self)) continue;
+
+		idle.fetch_add(1);
+		for (;;)
+		{
+			if (idle.load() == stacks.size()) return;
+			if (work_left())
+			{
+				idle.fetch_sub(1);
+				break;
+			}
+			std::this_thread::yield();
+		}
+	}
+}
+
+unsigned long long ParallelMarker::run(const std::vector<Cell> &roots)
+{
+	for (unsigned int i=0; i<roots.size(); ++i) stacks[i % stacks.size()]->local.push_back(roots[i]);
+
+	std::vector<std::thread> helpers;
+	for (unsigned int i=1; i<stacks.size(); ++i) helpers.push_back(std::thread(&ParallelMarker::work, this, i));
+	work(0);
+	for (unsigned int i=0; i<helpers.size(); ++i) helpers[i].join();
+
+	unsigned long long marked = 0;
+	for (unsigned int i=0; i<stacks.size(); ++i) marked += stacks[i]->marked;
+	return marked;
+}
+
+
+/* one sweeper's share of storage: the cells it found dead, and what freeing them released */
+struct SweepRange
+{
+	std::vector<GarbageCollector::Storage::iterator> dead;
+	TypeStatistics freed[CELL_TYPE_COUNT];
+	size_t bytes;
+
+	SweepRange() : freed(), bytes(0) {}
+};
+
+static void sweep_range(GarbageCollector::Storage::iterator *begin, GarbageCollector::Storage::iterator *end, SweepRange *range)
+{
+	for (GarbageCollector::Storage::iterator *iter=begin; iter!=end; ++iter)
+	{
+		std::atomic<bool> &marked = (*iter)->second;
+		if (marked.load(std::memory_order_relaxed))
+		{
+			marked.store(false, std::memory_order_relaxed);
+			continue;
+		}
+		range->dead.push_back(*iter);
+
+		/* strings share reference-counted buffers, so they are freed on the collecting thread */
+		Cell c = (*iter)->first;
+		if (c.type == STRING) continue;
+		size_t bytes = release(c);
+		range->freed[c.type].freed++;
+		range->freed[c.type].freed_bytes += bytes;
+		range->bytes += bytes;
+	}
+}
+
+/*
+	Frees unmarked cells in threads contiguous ranges of storage. Payloads
+	are released concurrently; the map itself is only changed afterwards, on
+	this thread, since erasing rebalances it.
+*/
+void GarbageCollector::parallel_sweep(unsigned int threads)
+{
+	std::vector<Storage::iterator> entries;
+	entries.reserve(storage.size());
+	for (Storage::iterator iter=storage.begin(); iter!=storage.end(); ++iter) entries.push_back(iter);
+
+	std::vector<SweepRange> ranges(threads);
+	std::vector<std::thread> helpers;
+	size_t chunk = (entries.size() + threads - 1) / threads;
+	for (unsigned int i=1; i<threads; ++i)
+	{
+		size_t begin = std::min(entries.size(), i * chunk);
+		size_t end = std::min(entries.size(), begin + chunk);
+		helpers.push_back(std::thread(sweep_range, entries.data() + begin, entries.data() + end, &ranges[i]));
+	}
+	/* the first range is swept here while the helpers run */
+	sweep_range(entries.data(), entries.data() + std::min(entries.size(), chunk), &ranges[0]);
+	for (unsigned int i=0; i<helpers.size(); ++i) helpers[i].join();
+
+	for (unsigned int i=0; i<threads; ++i)
+	{
+		SweepRange &range = ranges[i];
+		for (unsigned int t=0; t<CELL_TYPE_COUNT; ++t)
+		{
+			stats.types[t].freed += range.freed[t].freed;
+			stats.types[t].freed_bytes += range.freed[t].freed_bytes;
+		}
+		heap_bytes -= range.bytes;
+		for (unsigned int d=0; d<range.dead.size(); ++d)
+		{
+			if (range.dead[d]->first.type == STRING) dispose(range.dead[d]->first);
+			storage.erase(range.dead[d]);
+		}
+	}
+}
+
+
+static unsigned long long elapsed_ns(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point stop)
+{
+	return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+}
+
+void GarbageCollector::collect(const std::vector<Cell> &roots)
+{
+	CollectionStatistics collection;
+	collection.sequence = stats.collections + 1;
+	collection.heap_before = heap_bytes;
+	unsigned long long freed_before = 0;
+	for (unsigned int t=0; t<CELL_TYPE_COUNT; ++t) freed_before += stats.types[t].freed;
+
+	/* threads only pay for themselves once each has a few thousand cells to look at */
+	unsigned int threads = std::min<size_t>(marker_threads, std::max<size_t>(1, storage.size() / 4096));
+	collection.threads = threads;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	marked_cells = 0;
+	if (threads > 1)
+	{
+		std::vector<Cell> start_cells(roots);
+		for (std::vector<Cell>::iterator iter=arena.begin(); iter!=arena.end(); ++iter)
+		{
+			if (!is_unboxed(iter->type)) referenced_cells(*iter, start_cells);
+		}
+		marked_cells = ParallelMarker(storage, threads).run(start_cells);
+	}
+	else
+	{
+		for (std::vector<Cell>::const_iterator iter=roots.begin(); iter!=roots.end(); ++iter)
+		{
+			mark(*iter);
+		}
+		mark_arena();
+	}
+	std::chrono::steady_clock::time_point marked = std::chrono::steady_clock::now();
+	if (threads > 1) parallel_sweep(threads);
+	else sweep();
+	std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+	collection.mark_time = elapsed_ns(start, marked);
+	collection.sweep_time = elapsed_ns(marked, stop);
+	collection.pause_time = elapsed_ns(start, stop);
+	collection.heap_after = heap_bytes;
+	collection.marked = marked_cells;
+	collection.freed = 0;
+	for (unsigned int t=0; t<CELL_TYPE_COUNT; ++t) collection.freed += stats.types[t].freed;
+	collection.freed -= freed_before;
+
+	stats.collections++;
+	stats.total_pause_time += collection.pause_time;
+	stats.max_pause_time = std::max(stats.max_pause_time, collection.pause_time);
+	stats.last = collection;
+
+	if (collection_callback != NULL) collection_callback(collection, collection_data);
+}
+
+HeapStatistics GarbageCollector::statistics() const
+{
+	HeapStatistics result = stats;
+	result.heap_bytes = heap_bytes;
+	result.live_objects = 0;
+	for (unsigned int t=0; t<CELL_TYPE_COUNT; ++t)
+	{
+		result.live_objects += result.types[t].allocated - result.types[t].freed;
+	}
+	return result;
+}
+
+void GarbageCollector::set_collection_callback(CollectionCallback callback, void *data)
+{
+	collection_callback = callback;
+	collection_data = data;
+}
+
+
+/* heap dumps */
+
+/* bytes a cell accounts for on its own; a string buffer is split between the strings that view it */
+static size_t shallow_size(Cell c)
+{
+	switch (c.type)
+	{
+		case ZSTRING: return strlen(c.string) + 1;
+		case PROCEDURE: return sizeof(CodeBlock) + sizeof(Cell) * c.procedure->size;
+		case OBJECT: return sizeof(Object);
+		case ARRAY:
+			if (c.array->owner != NULL) return sizeof(Array);
+			return sizeof(Array) + Array::byteSize(c.array->element_type, c.array->length);
+		case STRING: {
+			StringBuffer *buffer = c.str->buffer;
+			return sizeof(String) + (sizeof(StringBuffer) + buffer->capacity) / std::max(buffer->references, 1u);
+		}
+		case ERROR: return sizeof(Error);
+		default: return 0;
+	}
+}
+
+/* everything reachable from a set of roots; node 0 stands for the roots themselves */
+struct HeapGraph
+{
+	std::vector<Cell> nodes;
+	std::vector< std::vector<unsigned int> > edges;
+	std::map<Cell, unsigned int, CellIdentityLess> ids;
+
+	HeapGraph() : nodes(1), edges(1) {}
+
+	unsigned int node(Cell c)
+	{
+		std::map<Cell, unsigned int, CellIdentityLess>::iterator found = ids.find(c);
+		if (found != ids.end()) return found->second;
+		unsigned int id = nodes.size();
+		ids[c] = id;
+		nodes.push_back(c);
+		edges.push_back(std::vector<unsigned int>());
+		return id;
+	}
+
+	void build(const std::vector<Cell> &roots)
+	{
+		for (unsigned int i=0; i<roots.size(); ++i)
+		{
+			if (is_unboxed(roots[i].type)) continue;
+			/* node() may grow edges, so look it up afterwards */
+			unsigned int id = node(roots[i]);
+			edges[0].push_back(id);
+		}
+		std::vector<Cell> children;
+		for (unsigned int i=1; i<nodes.size(); ++i)
+		{
+			children.clear();
+			referenced_cells(nodes[i], children);
+			for (unsigned int c=0; c<children.size(); ++c)
 			{
-				Cell key = *(iter.key);
-				Cell value = *(iter.value);
+				if (!is_unboxed(children[c].type))
+				{
+					unsigned int child = node(children[c]);
+					edges[i].push_back(child);
+				}
+			}
+		}
+	}
 
-				this->mark(key);
-				this->mark(value);
-			}			
+	/* nodes in depth-first postorder from node 0 */
+	void postorder(std::vector<unsigned int> &order) const
+	{
+		std::vector<bool> seen(nodes.size(), false);
+		std::vector< std::pair<unsigned int, unsigned int> > stack(1, std::make_pair(0u, 0u));
+		seen[0] = true;
+		while (!stack.empty())
+		{
+			unsigned int n = stack.back().first;
+			unsigned int &next = stack.back().second;
+			if (next < edges[n].size())
+			{
+				unsigned int child = edges[n][next++];
+				if (!seen[child])
+				{
+					seen[child] = true;
+					stack.push_back(std::make_pair(child, 0u));
+				}
+			}
+			else
+			{
+				order.push_back(n);
+				stack.pop_back();
+			}
+		}
+	}
+
+	/* immediate dominators, by Cooper, Harvey and Kennedy's iterative algorithm */
+	void dominators(const std::vector<unsigned int> &order, std::vector<unsigned int> &idom) const
+	{
+		const unsigned int UNDEFINED = ~0u;
+		std::vector<unsigned int> position(nodes.size());
+		for (unsigned int i=0; i<order.size(); ++i) position[order[i]] = i;
+
+		std::vector< std::vector<unsigned int> > predecessors(nodes.size());
+		for (unsigned int n=0; n<nodes.size(); ++n)
+		{
+			for (unsigned int e=0; e<edges[n].size(); ++e) predecessors[edges[n][e]].push_back(n);
+		}
+
+		idom.assign(nodes.size(), UNDEFINED);
+		idom[0] = 0;
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			for (unsigned int i=order.size() - 1; i-- > 0;)
+			{
+				unsigned int n = order[i];
+				unsigned int candidate = UNDEFINED;
+				for (unsigned int p=0; p<predecessors[n].size(); ++p)
+				{
+					unsigned int other = predecessors[n][p];
+					if (idom[other] == UNDEFINED) continue;
+					if (candidate == UNDEFINED)
+					{
+						candidate = other;
+						continue;
+					}
+					while (candidate != other)
+					{
+						while (position[candidate] < position[other]) candidate = idom[candidate];
+						while (position[other] < position[candidate]) other = idom[other];
+					}
+				}
+				if (idom[n] != candidate)
+				{
+					idom[n] = candidate;
+					changed = true;
+				}
+			}
 		}
 	}
+};
+
+static bool larger_retained(const std::pair<size_t, unsigned int> &lhs, const std::pair<size_t, unsigned int> &rhs)
+{
+	if (lhs.first != rhs.first) return lhs.first > rhs.first;
+	return lhs.second < rhs.second;
 }
 
+void GarbageCollector::dump_heap(std::ostream &output, const std::vector<Cell> &roots) const
+{
+	const unsigned int LARGEST_RETAINERS = 20;
+
+	/* arena allocations stay alive until end_arena, so they count as roots */
+	std::vector<Cell> all_roots(roots);
+	std::set<Cell, CellIdentityLess> in_arena;
+	for (std::vector<Cell>::const_iterator iter=arena.begin(); iter!=arena.end(); ++iter)
+	{
+		if (is_unboxed(iter->type)) continue;
+		all_roots.push_back(*iter);
+		in_arena.insert(*iter);
+	}
+
+	HeapGraph graph;
+	graph.build(all_roots);
+	std::vector<unsigned int> order;
+	graph.postorder(order);
+	std::vector<unsigned int> idom;
+	graph.dominators(order, idom);
+
+	/* cells the collector does not own, such as host-built procedures, are walked through but weigh nothing */
+	std::vector<bool> managed(graph.nodes.size(), false);
+	std::vector<size_t> size(graph.nodes.size(), 0);
+	for (unsigned int n=1; n<graph.nodes.size(); ++n)
+	{
+		managed[n] = storage.count(graph.nodes[n]) > 0 || in_arena.count(graph.nodes[n]) > 0;
+		if (managed[n]) size[n] = shallow_size(graph.nodes[n]);
+	}
+
+	/* a dominator always comes after the nodes it dominates in postorder */
+	std::vector<size_t> retained(size);
+	for (unsigned int i=0; i+1<order.size(); ++i)
+	{
+		unsigned int n = order[i];
+		retained[idom[n]] += retained[n];
+	}
+
+	std::map<std::string, std::pair<unsigned long long, size_t> > types;
+	std::vector< std::pair<size_t, unsigned int> > largest;
+
+	output << "{\n";
+	output << "  \"heap_bytes\": " << heap_bytes << ",\n";
+	output << "  \"reachable_bytes\": " << retained[0] << ",\n";
+	output << "  \"roots\": [";
+	for (unsigned int r=0; r<graph.edges[0].size(); ++r) output << (r > 0 ? ", " : "") << graph.edges[0][r];
+	output << "],\n";
+	output << "  \"nodes\": [";
+	for (unsigned int n=1; n<graph.nodes.size(); ++n)
+	{
+		std::string type = Cell::typeAsString(graph.nodes[n].type);
+		output << (n > 1 ? ",\n" : "\n");
+		output << "    {\"id\": " << n
+			<< ", \"type\": \"" << type << "\""
+			<< ", \"managed\": " << (managed[n] ? "true" : "false")
+			<< ", \"size\": " << size[n]
+			<< ", \"retained\": " << retained[n]
+			<< ", \"dominator\": " << idom[n]
+			<< ", \"references\": [";
+		for (unsigned int e=0; e<graph.edges[n].size(); ++e) output << (e > 0 ? ", " : "") << graph.edges[n][e];
+		output << "]}";
+
+		if (!managed[n]) continue;
+		types[type].first++;
+		types[type].second += size[n];
+		largest.push_back(std::make_pair(retained[n], n));
+	}
+	output << "\n  ],\n";
+
+	output << "  \"types\": {";
+	for (std::map<std::string, std::pair<unsigned long long, size_t> >::iterator iter=types.begin(); iter!=types.end(); ++iter)
+	{
+		output << (iter != types.begin() ? ",\n" : "\n");
+		output << "    \"" << iter->first << "\": {\"count\": " << iter->second.first << ", \"size\": " << iter->second.second << "}";
+	}
+	output << "\n  },\n";
+
+	std::sort(largest.begin(), largest.end(), larger_retained);
+	if (largest.size() > LARGEST_RETAINERS) largest.resize(LARGEST_RETAINERS);
+	output << "  \"largest_retainers\": [";
+	for (unsigned int i=0; i<largest.size(); ++i)
+	{
+		unsigned int n = largest[i].second;
+		output << (i > 0 ? ",\n" : "\n");
+		output << "    {\"id\": " << n
+			<< ", \"type\": \"" << Cell::typeAsString(graph.nodes[n].type) << "\""
+			<< ", \"size\": " << size[n]
+			<< ", \"retained\": " << retained[n] << "}";
+	}
+	output << "\n  ]\n}\n";
+}
@@ -0,0 +1,73 @@
+#include "pool.hpp"
+
+#include <algorithm>
+
+
+MachinePool::MachinePool(unsigned int prewarm, unsigned int cap, const CodeBlock *code)
+: prelude(code), capacity(cap < prewarm ? prewarm : cap)
+{
+	idle.reserve(capacity);
+	for (unsigned int i=0; i<prewarm; ++i)
+	{
+		idle.push_back(build());
+	}
+}
+
+MachinePool::~MachinePool()
+{
+	for (std::vector<RuntimeMachine*>::iterator iter=idle.begin(); iter!=idle.end(); ++iter)
+	{
+		delete *iter;
+	}
+}
+
+/*
+	Running a block writes its call count, JIT and verifier state, and the
+	procedures it compiles point back into it until their first call, so
+	machines built on different threads must not run the same block. Each
+	runs a copy of the prelude in its own heap instead.
+*/
+RuntimeMachine* MachinePool::build()
+{
+	RuntimeMachine *machine = new RuntimeMachine;
+	if (prelude != NULL)
+	{
+		CodeBlock *copy = machine->create_anonymous_procedure(prelude->size);
+		std::copy(prelude->text, prelude->text + prelude->size, copy->text);
+		copy->handlers = prelude->handlers;
+		machine->execute(copy);
+		machine->reset();
+	}
+	return machine;
+}
+
+RuntimeMachine* MachinePool::acquire()
+{
+	RuntimeMachine *machine = NULL;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!idle.empty())
+		{
+			machine = idle.back();
+			idle.pop_back();
+		}
+	}
+	/* an empty pool grows; the machine is built outside the lock */
+	if (machine == NULL) machine = build();
+	machine->begin_request();
+	return machine;
+}
+
+void MachinePool::release(RuntimeMachine *machine)
+{
+	machine->end_request();
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (idle.size() < capacity)
+		{
+			idle.push_back(machine);
+			return;
+		}
+	}
+	delete machine;
+}
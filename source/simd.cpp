@@ -0,0 +1,653 @@
+#include "simd.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/* scalar reference kernels; integer arithmetic goes through unsigned types so it wraps */
+
+template <typename T> struct Wrapping { typedef T type; };
+template <> struct Wrapping<int> { typedef unsigned int type; };
+template <> struct Wrapping<long long> { typedef unsigned long long type; };
+
+template <typename T>
+static void scalar_add(T *dst, const T *lhs, const T *rhs, unsigned int n)
+{
+	typedef typename Wrapping<T>::type W;
+	for (unsigned int i=0; i<n; ++i) dst[i] = static_cast<T>(static_cast<W>(lhs[i]) + static_cast<W>(rhs[i]));
+}
+
+template <typename T>
+static void scalar_multiply(T *dst, const T *lhs, const T *rhs, unsigned int n)
+{
+	typedef typename Wrapping<T>::type W;
+	for (unsigned int i=0; i<n; ++i) dst[i] = static_cast<T>(static_cast<W>(lhs[i]) * static_cast<W>(rhs[i]));
+}
+
+template <typename T>
+static long long scalar_sum_integer(const T *src, unsigned int n)
+{
+	unsigned long long total = 0;
+	for (unsigned int i=0; i<n; ++i) total += static_cast<unsigned long long>(src[i]);
+	return static_cast<long long>(total);
+}
+
+static double scalar_sum_float64(const double *src, unsigned int n)
+{
+	double total = 0.0;
+	for (unsigned int i=0; i<n; ++i) total += src[i];
+	return total;
+}
+
+template <typename T>
+static T scalar_min(const T *src, unsigned int n)
+{
+	T result = src[0];
+	for (unsigned int i=1; i<n; ++i) if (src[i] < result) result = src[i];
+	return result;
+}
+
+template <typename T>
+static T scalar_max(const T *src, unsigned int n)
+{
+	T result = src[0];
+	for (unsigned int i=1; i<n; ++i) if (src[i] > result) result = src[i];
+	return result;
+}
+
+/* NaN is unordered, so the float kernels stop at the first one and return it */
+static double scalar_min_float64(const double *src, unsigned int n)
+{
+	double result = src[0];
+	for (unsigned int i=0; i<n; ++i)
+	{
+		if (src[i] != src[i]) return src[i];
+		if (src[i] < result) result = src[i];
+	}
+	return result;
+}
+
+static double scalar_max_float64(const double *src, unsigned int n)
+{
+	double result = src[0];
+	for (unsigned int i=0; i<n; ++i)
+	{
+		if (src[i] != src[i]) return src[i];
+		if (src[i] > result) result = src[i];
+	}
+	return result;
+}
+
+template <typename T>
+static long scalar_find(const T *src, unsigned int n, T value)
+{
+	for (unsigned int i=0; i<n; ++i) if (src[i] == value) return static_cast<long>(i);
+	return -1;
+}
+
+static const ArrayKernels scalar_kernels = {
+	"scalar",
+	scalar_add<int>, scalar_add<long long>, scalar_add<double>, scalar_add<unsigned char>,
+	scalar_multiply<int>, scalar_multiply<long long>, scalar_multiply<double>, scalar_multiply<unsigned char>,
+	scalar_sum_integer<int>, scalar_sum_integer<long long>, scalar_sum_float64, scalar_sum_integer<unsigned char>,
+	scalar_min<int>, scalar_min<long long>, scalar_min_float64, scalar_min<unsigned char>,
+	scalar_max<int>, scalar_max<long long>, scalar_max_float64, scalar_max<unsigned char>,
+	scalar_find<int>, scalar_find<long long>, scalar_find<double>, scalar_find<unsigned char>
+};
+
+const ArrayKernels &scalar_array_kernels()
+{
+	return scalar_kernels;
+}
+
+#ifdef SIMD_X86
+
+/*
+	SSE2 kernels. Every loop handles whole vectors with unaligned loads (slices
+	may start anywhere in a buffer) and finishes the tail with scalar code.
+*/
+
+static void sse2_add_int32(int *dst, const int *lhs, const int *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(lhs + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(rhs + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi32(a, b));
+	}
+	scalar_add(dst + i, lhs + i, rhs + i, n - i);
+}
+
+static void sse2_add_int64(long long *dst, const long long *lhs, const long long *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(lhs + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(rhs + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi64(a, b));
+	}
+	scalar_add(dst + i, lhs + i, rhs + i, n - i);
+}
+
+static void sse2_add_float64(double *dst, const double *lhs, const double *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		_mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(lhs + i), _mm_loadu_pd(rhs + i)));
+	}
+	scalar_add(dst + i, lhs + i, rhs + i, n - i);
+}
+
+static void sse2_add_byte(unsigned char *dst, const unsigned char *lhs, const unsigned char *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(lhs + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(rhs + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(a, b));
+	}
+	scalar_add(dst + i, lhs + i, rhs + i, n - i);
+}
+
+static void sse2_multiply_float64(double *dst, const double *lhs, const double *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		_mm_storeu_pd(dst + i, _mm_mul_pd(_mm_loadu_pd(lhs + i), _mm_loadu_pd(rhs + i)));
+	}
+	scalar_multiply(dst + i, lhs + i, rhs + i, n - i);
+}
+
+static long long sse2_sum_int64(const long long *src, unsigned int n)
+{
+	__m128i acc = _mm_setzero_si128();
+	unsigned int i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i*)(src + i)));
+	}
+	long long lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	return static_cast<long long>(static_cast<unsigned long long>(lanes[0]) + lanes[1] + scalar_sum_integer(src + i, n - i));
+}
+
+static double sse2_sum_float64(const double *src, unsigned int n)
+{
+	__m128d acc = _mm_setzero_pd();
+	unsigned int i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		acc = _mm_add_pd(acc, _mm_loadu_pd(src + i));
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, acc);
+	return lanes[0] + lanes[1] + scalar_sum_float64(src + i, n - i);
+}
+
+static long long sse2_sum_byte(const unsigned char *src, unsigned int n)
+{
+	__m128i acc = _mm_setzero_si128();
+	__m128i zero = _mm_setzero_si128();
+	unsigned int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		/* sum of absolute differences against zero adds 8 bytes into each 64-bit lane */
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(src + i)), zero));
+	}
+	long long lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	return lanes[0] + lanes[1] + scalar_sum_integer(src + i, n - i);
+}
+
+static double sse2_min_float64(const double *src, unsigned int n)
+{
+	if (n < 2) return scalar_min_float64(src, n);
+	__m128d acc = _mm_loadu_pd(src);
+	__m128d unordered = _mm_cmpunord_pd(acc, acc);
+	unsigned int i = 2;
+	for (; i + 2 <= n; i += 2)
+	{
+		__m128d value = _mm_loadu_pd(src + i);
+		unordered = _mm_or_pd(unordered, _mm_cmpunord_pd(value, value));
+		acc = _mm_min_pd(acc, value);
+	}
+	/* minpd and maxpd drop NaN operands, so any NaN is left to the scalar kernel */
+	if (_mm_movemask_pd(unordered) != 0) return scalar_min_float64(src, n);
+	double lanes[2];
+	_mm_storeu_pd(lanes, acc);
+	double result = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+	for (; i<n; ++i)
+	{
+		if (src[i] != src[i]) return src[i];
+		if (src[i] < result) result = src[i];
+	}
+	return result;
+}
+
+static double sse2_max_float64(const double *src, unsigned int n)
+{
+	if (n < 2) return scalar_max_float64(src, n);
+	__m128d acc = _mm_loadu_pd(src);
+	__m128d unordered = _mm_cmpunord_pd(acc, acc);
+	unsigned int i = 2;
+	for (; i + 2 <= n; i += 2)
+	{
+		__m128d value = _mm_loadu_pd(src + i);
+		unordered = _mm_or_pd(unordered, _mm_cmpunord_pd(value, value));
+		acc = _mm_max_pd(acc, value);
+	}
+	if (_mm_movemask_pd(unordered) != 0) return scalar_max_float64(src, n);
+	double lanes[2];
+	_mm_storeu_pd(lanes, acc);
+	double result = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+	for (; i<n; ++i)
+	{
+		if (src[i] != src[i]) return src[i];
+		if (src[i] > result) result = src[i];
+	}
+	return result;
+}
+
+static unsigned char sse2_min_byte(const unsigned char *src, unsigned int n)
+{
+	if (n < 16) return scalar_min(src, n);
+	__m128i acc = _mm_loadu_si128((const __m128i*)src);
+	unsigned int i = 16;
+	for (; i + 16 <= n; i += 16) acc = _mm_min_epu8(acc, _mm_loadu_si128((const __m128i*)(src + i)));
+	unsigned char lanes[16];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	unsigned char result = scalar_min(lanes, 16);
+	for (; i<n; ++i) if (src[i] < result) result = src[i];
+	return result;
+}
+
+static unsigned char sse2_max_byte(const unsigned char *src, unsigned int n)
+{
+	if (n < 16) return scalar_max(src, n);
+	__m128i acc = _mm_loadu_si128((const __m128i*)src);
+	unsigned int i = 16;
+	for (; i + 16 <= n; i += 16) acc = _mm_max_epu8(acc, _mm_loadu_si128((const __m128i*)(src + i)));
+	unsigned char lanes[16];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	unsigned char result = scalar_max(lanes, 16);
+	for (; i<n; ++i) if (src[i] > result) result = src[i];
+	return result;
+}
+
+static long sse2_find_int32(const int *src, unsigned int n, int value)
+{
+	__m128i needle = _mm_set1_epi32(value);
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i hits = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(src + i)), needle);
+		int mask = _mm_movemask_ps(_mm_castsi128_ps(hits));
+		if (mask) return static_cast<long>(i + __builtin_ctz(mask));
+	}
+	long rest = scalar_find(src + i, n - i, value);
+	return rest < 0 ? rest : static_cast<long>(i) + rest;
+}
+
+static long sse2_find_float64(const double *src, unsigned int n, double value)
+{
+	__m128d needle = _mm_set1_pd(value);
+	unsigned int i = 0;
+	for (; i + 2 <= n; i += 2)
+	{
+		int mask = _mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(src + i), needle));
+		if (mask) return static_cast<long>(i + __builtin_ctz(mask));
+	}
+	long rest = scalar_find(src + i, n - i, value);
+	return rest < 0 ? rest : static_cast<long>(i) + rest;
+}
+
+static long sse2_find_byte(const unsigned char *src, unsigned int n, unsigned char value)
+{
+	__m128i needle = _mm_set1_epi8(static_cast<char>(value));
+	unsigned int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(src + i)), needle));
+		if (mask) return static_cast<long>(i + __builtin_ctz(mask));
+	}
+	long rest = scalar_find(src + i, n - i, value);
+	return rest < 0 ? rest : static_cast<long>(i) + rest;
+}
+
+static const ArrayKernels sse2_kernels = {
+	"sse2",
+	sse2_add_int32, sse2_add_int64, sse2_add_float64, sse2_add_byte,
+	scalar_multiply<int>, scalar_multiply<long long>, sse2_multiply_float64, scalar_multiply<unsigned char>,
+	scalar_sum_integer<int>, sse2_sum_int64, sse2_sum_float64, sse2_sum_byte,
+	scalar_min<int>, scalar_min<long long>, sse2_min_float64, sse2_min_byte,
+	scalar_max<int>, scalar_max<long long>, sse2_max_float64, sse2_max_byte,
+	sse2_find_int32, scalar_find<long long>, sse2_find_float64, sse2_find_byte
+};
+
+/* AVX2 kernels are compiled for that target only and selected at runtime */
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static void avx2_add_int32(int *dst, const int *lhs, const int *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(lhs + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(rhs + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi32(a, b));
+	}
+	scalar_add(dst + i, lhs + i, rhs + i, n - i);
+}
+
+AVX2 static void avx2_add_int64(long long *dst, const long long *lhs, const long long *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(lhs + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(rhs + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi64(a, b));
+	}
+	scalar_add(dst + i, lhs + i, rhs + i, n - i);
+}
+
+AVX2 static void avx2_add_float64(double *dst, const double *lhs, const double *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		_mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(lhs + i), _mm256_loadu_pd(rhs + i)));
+	}
+	scalar_add(dst + i, lhs + i, rhs + i, n - i);
+}
+
+AVX2 static void avx2_add_byte(unsigned char *dst, const unsigned char *lhs, const unsigned char *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(lhs + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(rhs + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_add_epi8(a, b));
+	}
+	scalar_add(dst + i, lhs + i, rhs + i, n - i);
+}
+
+AVX2 static void avx2_multiply_int32(int *dst, const int *lhs, const int *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(lhs + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(rhs + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_mullo_epi32(a, b));
+	}
+	scalar_multiply(dst + i, lhs + i, rhs + i, n - i);
+}
+
+AVX2 static void avx2_multiply_float64(double *dst, const double *lhs, const double *rhs, unsigned int n)
+{
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		_mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(lhs + i), _mm256_loadu_pd(rhs + i)));
+	}
+	scalar_multiply(dst + i, lhs + i, rhs + i, n - i);
+}
+
+AVX2 static long long avx2_sum_int32(const int *src, unsigned int n)
+{
+	/* widen to 64-bit lanes so the total cannot wrap before the int64 result would */
+	__m256i acc = _mm256_setzero_si256();
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+		acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+		acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+	}
+	long long lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	unsigned long long total = static_cast<unsigned long long>(scalar_sum_integer(src + i, n - i));
+	for (int lane=0; lane<4; ++lane) total += static_cast<unsigned long long>(lanes[lane]);
+	return static_cast<long long>(total);
+}
+
+AVX2 static long long avx2_sum_int64(const long long *src, unsigned int n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		acc = _mm256_add_epi64(acc, _mm256_loadu_si256((const __m256i*)(src + i)));
+	}
+	long long lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	unsigned long long total = static_cast<unsigned long long>(scalar_sum_integer(src + i, n - i));
+	for (int lane=0; lane<4; ++lane) total += static_cast<unsigned long long>(lanes[lane]);
+	return static_cast<long long>(total);
+}
+
+AVX2 static double avx2_sum_float64(const double *src, unsigned int n)
+{
+	__m256d acc = _mm256_setzero_pd();
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		acc = _mm256_add_pd(acc, _mm256_loadu_pd(src + i));
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, acc);
+	return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + scalar_sum_float64(src + i, n - i);
+}
+
+AVX2 static long long avx2_sum_byte(const unsigned char *src, unsigned int n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m256i zero = _mm256_setzero_si256();
+	unsigned int i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)(src + i)), zero));
+	}
+	long long lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + scalar_sum_integer(src + i, n - i);
+}
+
+AVX2 static int avx2_min_int32(const int *src, unsigned int n)
+{
+	if (n < 8) return scalar_min(src, n);
+	__m256i acc = _mm256_loadu_si256((const __m256i*)src);
+	unsigned int i = 8;
+	for (; i + 8 <= n; i += 8) acc = _mm256_min_epi32(acc, _mm256_loadu_si256((const __m256i*)(src + i)));
+	int lanes[8];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	int result = scalar_min(lanes, 8);
+	for (; i<n; ++i) if (src[i] < result) result = src[i];
+	return result;
+}
+
+AVX2 static int avx2_max_int32(const int *src, unsigned int n)
+{
+	if (n < 8) return scalar_max(src, n);
+	__m256i acc = _mm256_loadu_si256((const __m256i*)src);
+	unsigned int i = 8;
+	for (; i + 8 <= n; i += 8) acc = _mm256_max_epi32(acc, _mm256_loadu_si256((const __m256i*)(src + i)));
+	int lanes[8];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	int result = scalar_max(lanes, 8);
+	for (; i<n; ++i) if (src[i] > result) result = src[i];
+	return result;
+}
+
+AVX2 static double avx2_min_float64(const double *src, unsigned int n)
+{
+	if (n < 4) return scalar_min_float64(src, n);
+	__m256d acc = _mm256_loadu_pd(src);
+	__m256d unordered = _mm256_cmp_pd(acc, acc, _CMP_UNORD_Q);
+	unsigned int i = 4;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256d value = _mm256_loadu_pd(src + i);
+		unordered = _mm256_or_pd(unordered, _mm256_cmp_pd(value, value, _CMP_UNORD_Q));
+		acc = _mm256_min_pd(acc, value);
+	}
+	if (_mm256_movemask_pd(unordered) != 0) return scalar_min_float64(src, n);
+	double lanes[4];
+	_mm256_storeu_pd(lanes, acc);
+	double result = scalar_min(lanes, 4);
+	for (; i<n; ++i)
+	{
+		if (src[i] != src[i]) return src[i];
+		if (src[i] < result) result = src[i];
+	}
+	return result;
+}
+
+AVX2 static double avx2_max_float64(const double *src, unsigned int n)
+{
+	if (n < 4) return scalar_max_float64(src, n);
+	__m256d acc = _mm256_loadu_pd(src);
+	__m256d unordered = _mm256_cmp_pd(acc, acc, _CMP_UNORD_Q);
+	unsigned int i = 4;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256d value = _mm256_loadu_pd(src + i);
+		unordered = _mm256_or_pd(unordered, _mm256_cmp_pd(value, value, _CMP_UNORD_Q));
+		acc = _mm256_max_pd(acc, value);
+	}
+	if (_mm256_movemask_pd(unordered) != 0) return scalar_max_float64(src, n);
+	double lanes[4];
+	_mm256_storeu_pd(lanes, acc);
+	double result = scalar_max(lanes, 4);
+	for (; i<n; ++i)
+	{
+		if (src[i] != src[i]) return src[i];
+		if (src[i] > result) result = src[i];
+	}
+	return result;
+}
+
+AVX2 static unsigned char avx2_min_byte(const unsigned char *src, unsigned int n)
+{
+	if (n < 32) return scalar_min(src, n);
+	__m256i acc = _mm256_loadu_si256((const __m256i*)src);
+	unsigned int i = 32;
+	for (; i + 32 <= n; i += 32) acc = _mm256_min_epu8(acc, _mm256_loadu_si256((const __m256i*)(src + i)));
+	unsigned char lanes[32];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	unsigned char result = scalar_min(lanes, 32);
+	for (; i<n; ++i) if (src[i] < result) result = src[i];
+	return result;
+}
+
+AVX2 static unsigned char avx2_max_byte(const unsigned char *src, unsigned int n)
+{
+	if (n < 32) return scalar_max(src, n);
+	__m256i acc = _mm256_loadu_si256((const __m256i*)src);
+	unsigned int i = 32;
+	for (; i + 32 <= n; i += 32) acc = _mm256_max_epu8(acc, _mm256_loadu_si256((const __m256i*)(src + i)));
+	unsigned char lanes[32];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	unsigned char result = scalar_max(lanes, 32);
+	for (; i<n; ++i) if (src[i] > result) result = src[i];
+	return result;
+}
+
+AVX2 static long avx2_find_int32(const int *src, unsigned int n, int value)
+{
+	__m256i needle = _mm256_set1_epi32(value);
+	unsigned int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i hits = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(src + i)), needle);
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hits));
+		if (mask) return static_cast<long>(i + __builtin_ctz(mask));
+	}
+	long rest = scalar_find(src + i, n - i, value);
+	return rest < 0 ? rest : static_cast<long>(i) + rest;
+}
+
+AVX2 static long avx2_find_int64(const long long *src, unsigned int n, long long value)
+{
+	__m256i needle = _mm256_set1_epi64x(value);
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256i hits = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(src + i)), needle);
+		int mask = _mm256_movemask_pd(_mm256_castsi256_pd(hits));
+		if (mask) return static_cast<long>(i + __builtin_ctz(mask));
+	}
+	long rest = scalar_find(src + i, n - i, value);
+	return rest < 0 ? rest : static_cast<long>(i) + rest;
+}
+
+AVX2 static long avx2_find_float64(const double *src, unsigned int n, double value)
+{
+	__m256d needle = _mm256_set1_pd(value);
+	unsigned int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		int mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(src + i), needle, _CMP_EQ_OQ));
+		if (mask) return static_cast<long>(i + __builtin_ctz(mask));
+	}
+	long rest = scalar_find(src + i, n - i, value);
+	return rest < 0 ? rest : static_cast<long>(i) + rest;
+}
+
+AVX2 static long avx2_find_byte(const unsigned char *src, unsigned int n, unsigned char value)
+{
+	__m256i needle = _mm256_set1_epi8(static_cast<char>(value));
+	unsigned int i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(src + i)), needle)));
+		if (mask) return static_cast<long>(i + __builtin_ctz(mask));
+	}
+	long rest = scalar_find(src + i, n - i, value);
+	return rest < 0 ? rest : static_cast<long>(i) + rest;
+}
+
+#undef AVX2
+
+static const ArrayKernels avx2_kernels = {
+	"avx2",
+	avx2_add_int32, avx2_add_int64, avx2_add_float64, avx2_add_byte,
+	avx2_multiply_int32, scalar_multiply<long long>, avx2_multiply_float64, scalar_multiply<unsigned char>,
+	avx2_sum_int32, avx2_sum_int64, avx2_sum_float64, avx2_sum_byte,
+	avx2_min_int32, scalar_min<long long>, avx2_min_float64, avx2_min_byte,
+	avx2_max_int32, scalar_max<long long>, avx2_max_float64, avx2_max_byte,
+	avx2_find_int32, avx2_find_int64, avx2_find_float64, avx2_find_byte
+};
+
+static const ArrayKernels *select_kernels()
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return &avx2_kernels;
+	if (__builtin_cpu_supports("sse2")) return &sse2_kernels;
+	return &scalar_kernels;
+}
+
+#else
+
+static const ArrayKernels *select_kernels()
+{
+	return &scalar_kernels;
+}
+
+#endif
+
+const ArrayKernels &array_kernels()
+{
+	static const ArrayKernels *selected = select_kernels();
+	return *selected;
+}
@@ -0,0 +1,56 @@
+#include "interpreter.hpp"
+
+#include <string>
+#include <cstring>
+
+
+String::String(StringBuffer *buf, unsigned int off, unsigned int len)
+: buffer(buf), offset(off), length(len), hash_value(0) {}
+
+/* FNV-1a; zero marks a hash that has not been computed yet */
+unsigned int String::hash() const
+{
+	if (hash_value == 0)
+	{
+		unsigned int h = 2166136261u;
+		const unsigned char *chars = reinterpret_cast<const unsigned char*>(data());
+		for (unsigned int i=0; i<length; ++i)
+		{
+			h ^= chars[i];
+			h *= 16777619u;
+		}
+		hash_value = h != 0 ? h : 1;
+	}
+	return hash_value;
+}
+
+bool String::equals(const String *other) const
+{
+	if (length != other->length) return false;
+	if (data() == other->data()) return true;
+	/* only compare hashes that are already known; computing one costs as much as memcmp */
+	if (hash_value != 0 && other->hash_value != 0 && hash_value != other->hash_value) return false;
+	return memcmp(data(), other->data(), length) == 0;
+}
+
+int String::compare(const String *other) const
+{
+	unsigned int common = length < other->length ? length : other->length;
+	int result = memcmp(data(), other->data(), common);
+	if (result != 0) return result < 0 ? -1 : 1;
+	if (length == other->length) return 0;
+	return length < other->length ? -1 : 1;
+}
+
+int String::find(const String *needle) const
+{
+	if (needle->length == 0) return 0;
+	const void *hit = memmem(data(), length, needle->data(), needle->length);
+	if (hit == NULL) return -1;
+	return static_cast<int>(static_cast<const char*>(hit) - data());
+}
+
+std::string String::toString() const
+{
+	return std::string(data(), length);
+}
@@ -0,0 +1,208 @@
+#include <vector>
+#include <cstring>
+
+#include "verifier.hpp"
+#include "instructions.hpp"
+
+/* abstract cells use the signature letters from opcodes.def */
+typedef std::vector<char> AbstractStack;
+
+static const char ANY_TYPE = '.';
+
+static char abstract_type(const Cell &cell)
+{
+	switch (cell.type)
+	{
+		case INT32: return 'i';
+		case INT64: return 'l';
+		case FLOAT64: return 'd';
+		case OBJECT: return 'o';
+		case ARRAY: return 'a';
+		case STRING: return 's';
+		case ZSTRING: return 'z';
+		case PROCEDURE: return 'p';
+		case ERROR: return 'e';
+		default: return ANY_TYPE;
+	}
+}
+
+struct BlockState
+{
+	bool reached;
+	AbstractStack stack;
+
+	BlockState() : reached(false) {}
+};
+
+class Verifier
+{
+	const CodeBlock *block;
+	std::vector<unsigned int> widths;
+	std::vector<BlockState> states;
+	std::vector<unsigned int> worklist;
+
+	public:
+	Verifier(const CodeBlock *b) : block(b), widths(b->size, 0), states(b->size) {}
+
+	bool run()
+	{
+		if (block->size == 0) return false;
+
+		/* linear decode fixes the instruction boundaries */
+		unsigned int index = 0;
+		while (index < block->size)
+		{
+			unsigned int width = instruction_width(block, index);
+			if (width == 0) return false;
+			widths[index] = width;
+			index += width;
+		}
+
+		states[0].reached = true;
+		worklist.push_back(0);
+
+		/* handlers are entered with the error on top of an unknown stack */
+		for (unsigned int i=0; i<block->handlers.size(); ++i)
+		{
+			if (!flow(block->handlers[i].target, AbstractStack(1, 'e'))) return false;
+		}
+		while (!worklist.empty())
+		{
+			unsigned int current = worklist.back();
+			worklist.pop_back();
+			if (!step(current)) return false;
+		}
+		return true;
+	}
+
+	private:
+	/* merges state into the instruction at index; false if the depths disagree */
+	bool flow(unsigned int index, const AbstractStack &stack)
+	{
+		if (index >= block->size || widths[index] == 0) return false;
+
+		BlockState &target = states[index];
+		if (!target.reached)
+		{
+			target.reached = true;
+			target.stack = stack;
+			worklist.push_back(index);
+			return true;
+		}
+		if (target.stack.size() != stack.size()) return false;
+
+		bool changed = false;
+		for (unsigned int i=0; i<stack.size(); ++i)
+		{
+			if (target.stack[i] != stack[i] && target.stack[i] != ANY_TYPE)
+			{
+				target.stack[i] = ANY_TYPE;
+				changed = true;
+			}
+		}
+		if (changed) worklist.push_back(index);
+		return true;
+	}
+
+	bool step(unsigned int index)
+	{
+		AbstractStack stack = states[index].stack;
+		const Cell &cell = block->text[index];
+		unsigned int next = index + widths[index];
+
+		if (cell.type != INSTRUCTION)
+		{
+			/* procedure calls and word lookups; the callee may leave anything */
+			if (cell.type != PROCEDURE && cell.type != ZSTRING) return false;
+			return flow(next, AbstractStack());
+		}
+
+		const InstructionInfo &info = instruction_table[cell.opcode];
+		if (info.flags & INSTRUCTION_UNCHECKED)
+		{
+			if (!apply_unchecked(cell.opcode, info, index, stack)) return false;
+		}
+		else if (info.flags & INSTRUCTION_CALL)
+		{
+			stack.clear();
+		}
+		else
+		{
+			apply_checked(info, stack);
+		}
+
+		if (info.flags & INSTRUCTION_BRANCH)
+		{
+			const Cell &offset = block->text[index + 1];
+			long long target = static_cast<long long>(index) + 2 + offset.int32;
+			if (target < 0 || target >= block->size) return false;
+			if (!flow(static_cast<unsigned int>(target), stack)) return false;
+			if (!(info.flags & INSTRUCTION_CONDITIONAL)) return true;
+		}
+		if (info.flags & INSTRUCTION_TERMINATES) return true;
+		return flow(next, stack);
+	}
+
+	/* operands must be tracked and typed; nothing is checked at run time */
+	bool apply_unchecked(Opcode code, const InstructionInfo &info, unsigned int index, AbstractStack &stack)
+	{
+		unsigned int pops = static_cast<unsigned int>(info.pops);
+		if (stack.size() < pops) return false;
+
+		switch (code)
+		{
+			case OP_load_immediate:
+				stack.push_back(abstract_type(block->text[index + 1]));
+				return true;
+			case OP_duplicate:
+				stack.push_back(stack.back());
+				return true;
+			case OP_drop:
+				stack.pop_back();
+				return true;
+			case OP_swap:
+				std::swap(stack[stack.size() - 1], stack[stack.size() - 2]);
+				return true;
+			case OP_over:
+				stack.push_back(stack[stack.size() - 2]);
+				return true;
+			default:
+				break;
+		}
+
+		if (info.flags & INSTRUCTION_BRANCH && block->text[index + 1].type != INT32) return false;
+
+		const char *signature = info.signature;
+		const char *results = strchr(signature, '>');
+		if (results == NULL) return pops == 0 && info.pushes == 0;
+		if (static_cast<unsigned int>(results - signature) != pops) return false;
+		for (unsigned int i=0; i<pops; ++i)
+		{
+			if (stack[stack.size() - pops + i] != signature[i]) return false;
+		}
+		stack.resize(stack.size() - pops);
+		for (const char *r=results + 1; *r; ++r) stack.push_back(*r);
+		return true;
+	}
+
+	/* the instruction checks its own operands; only its results are tracked */
+	void apply_checked(const InstructionInfo &info, AbstractStack &stack)
+	{
+		unsigned int pops = static_cast<unsigned int>(info.pops);
+		stack.resize(stack.size() > pops ? stack.size() - pops : 0);
+
+		const char *results = strchr(info.signature, '>');
+		for (int i=0; i<info.pushes; ++i)
+		{
+			stack.push_back(results != NULL && results[1 + i] ? results[1 + i] : ANY_TYPE);
+		}
+	}
+};
+
+bool verify_procedure(const CodeBlock *block)
+{
+	if (block->verified) return true;
+	Verifier verifier(block);
+	block->verified = verifier.run();
+	return block->verified;
+}
@@ -0,0 +1,565 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <climits>
+
+#include "interpreter.hpp"
+#include "instructions.hpp"
+#include "verifier.hpp"
+#include "jit.hpp"
+
+/*
+	Differential test of the JIT: every case runs under the checked
+	interpreter, the verified interpreter (when the block verifies) and
+	native code, and all of them must leave the same stack, raise the same
+	error and suspend as often. Native code is compiled up front rather than
+	once the block is hot, so every case starts in it.
+*/
+
+struct Program
+{
+	std::vector<Cell> cells;
+
+	unsigned int here() const { return cells.size(); }
+	Program &emit(Cell c) { cells.push_back(c); return *this; }
+	Program &emit(Instruction inst) { return emit(Cell(inst)); }
+	Program &immediate(Cell value) { return emit(load_immediate).emit(value); }
+
+	/* emits a jump and returns the index of its offset cell */
+	unsigned int jump(Instruction inst)
+	{
+		emit(inst).emit(Cell(0));
+		return here() - 1;
+	}
+	/* offsets are relative to the cell following the offset operand */
+	void patch(unsigned int offset_cell, unsigned int target)
+	{
+		cells[offset_cell] = Cell(static_cast<int>(target) - static_cast<int>(offset_cell + 1));
+	}
+};
+
+struct Case
+{
+	std::string name;
+	Program program;
+	/* pushed bottom first before the block runs */
+	std::vector<Cell> stack;
+	/* fuel per resume; 0 runs to the end in one go */
+	unsigned long long fuel;
+	/* the block must compile to native code that can be entered at its first cell */
+	bool native;
+};
+
+enum Mode { CHECKED, VERIFIED, COMPILED };
+static const char *mode_names[] = { "checked", "verified", "jit" };
+
+static std::string describe_stack(RuntimeMachine &machine)
+{
+	std::vector<Cell> cells;
+	try
+	{
+		for (;;) cells.push_back(machine.pop_argument());
+	}
+	catch (ExecutionOutOfBoundsError&)
+	{
+	}
+	std::string result = "[";
+	for (unsigned int i=cells.size(); i>0; --i)
+	{
+		result += cells[i - 1].toString();
+		if (i > 1) result += " ";
+	}
+	return result + "]";
+}
+
+/* the final stack, the error if one escaped and the number of suspensions */
+static std::string run(const Case &c, Mode mode, bool *entered)
+{
+	std::vector<Cell> text(c.program.cells);
+	CodeBlock block(text.size(), &text[0]);
+	if (mode != CHECKED) verify_procedure(&block);
+	if (mode == COMPILED)
+	{
+		block.native = jit_compile(&block);
+		*entered = jit_can_enter(block.native, 0);
+	}
+
+	RuntimeMachine machine;
+	machine.set_jit_enabled(mode == COMPILED);
+	for (unsigned int i=0; i<c.stack.size(); ++i) machine.push_argument(c.stack[i]);
+
+	std::stringstream outcome;
+	unsigned int suspensions = 0;
+	try
+	{
+		machine.set_fuel(c.fuel);
+		machine.execute(&block);
+		while (machine.status() == EXECUTION_OUT_OF_FUEL)
+		{
+			++suspensions;
+			machine.set_fuel(c.fuel);
+			machine.resume();
+		}
+	}
+	catch (ArithmeticError &e) { outcome << "ArithmeticError(" << e.what() << ") "; }
+	catch (CellTypeException &e) { outcome << "CellTypeException(" << e.what() << ") "; }
+	catch (ExecutionOutOfBoundsError &e) { outcome << "ExecutionOutOfBoundsError(" << e.what() << ") "; }
+	catch (std::exception &e) { outcome << "exception(" << e.what() << ") "; }
+
+	outcome << describe_stack(machine);
+	if (suspensions > 0) outcome << " after " << suspensions << " suspensions";
+	return outcome.str();
+}
+
+/* instruction cases */
+
+static const int operands[][2] = {
+	{ 7, 3 }, { -7, 3 }, { 7, -3 }, { 0, 5 }, { 5, 0 }, { INT_MAX, 1 }, { INT_MIN, 1 },
+	{ INT_MIN, -1 }, { INT_MAX, -1 }, { 65536, 65536 }, { -1, -1 }, { 12, 12 }
+};
+
+static void binary_cases(std::vector<Case> &cases)
+{
+	const struct { const char *name; Instruction inst; } ops[] = {
+		{ "add", add_int32 }, { "subtract", subtract_int32 }, { "multiply", multiply_int32 },
+		{ "divide", divide_int32 }, { "modulo", modulo_int32 },
+		{ "equal", equal_int32 }, { "not_equal", not_equal_int32 }, { "less", less_int32 },
+		{ "less_equal", less_equal_int32 }, { "greater", greater_int32 }, { "greater_equal", greater_equal_int32 }
+	};
+
+	for (unsigned int o=0; o<sizeof(ops)/sizeof(ops[0]); ++o)
+	{
+		for (unsigned int i=0; i<sizeof(operands)/sizeof(operands[0]); ++i)
+		{
+			int lhs = operands[i][0], rhs = operands[i][1];
+			std::stringstream name;
+			name << ops[o].name << "(" << lhs << ", " << rhs << ")";
+
+			/* both operands are constants folded at compile time */
+			Case folded = { name.str() + " constants", Program(), std::vector<Cell>(), 0, true };
+			folded.program.immediate(Cell(lhs)).immediate(Cell(rhs)).emit(ops[o].inst).emit(exit_program);
+			cases.push_back(folded);
+
+			/* both are popped off the real stack into registers */
+			Case popped = { name.str() + " registers", Program(), std::vector<Cell>(), 0, true };
+			popped.stack.push_back(Cell(lhs));
+			popped.stack.push_back(Cell(rhs));
+			popped.program.emit(ops[o].inst).emit(exit_program);
+			cases.push_back(popped);
+
+			/* a register and a constant either way round */
+			Case right = { name.str() + " constant rhs", Program(), std::vector<Cell>(), 0, true };
+			right.stack.push_back(Cell(lhs));
+			right.program.immediate(Cell(rhs)).emit(ops[o].inst).emit(exit_program);
+			cases.push_back(right);
+
+			Case left = { name.str() + " constant lhs", Program(), std::vector<Cell>(), 0, true };
+			left.stack.push_back(Cell(rhs));
+			left.program.immediate(Cell(lhs)).emit(swap).emit(ops[o].inst).emit(exit_program);
+			cases.push_back(left);
+		}
+
+		/* operands of the wrong type leave native code before the instruction */
+		Case mistyped = { std::string(ops[o].name) + " float64 operand", Program(), std::vector<Cell>(), 0, true };
+		mistyped.stack.push_back(Cell(1.5));
+		mistyped.stack.push_back(Cell(2));
+		mistyped.program.emit(ops[o].inst).emit(exit_program);
+		cases.push_back(mistyped);
+
+		Case underflow = { std::string(ops[o].name) + " stack underflow", Program(), std::vector<Cell>(), 0, true };
+		underflow.stack.push_back(Cell(2));
+		underflow.program.emit(ops[o].inst).emit(exit_program);
+		cases.push_back(underflow);
+	}
+}
+
+static void negate_cases(std::vector<Case> &cases)
+{
+	const int values[] = { 5, 0, -9, INT_MAX, INT_MIN };
+	for (unsigned int i=0; i<sizeof(values)/sizeof(values[0]); ++i)
+	{
+		std::stringstream name;
+		name << "negate(" << values[i] << ")";
+
+		Case folded = { name.str() + " constant", Program(), std::vector<Cell>(), 0, true };
+		folded.program.immediate(Cell(values[i])).emit(negate_int32).emit(exit_program);
+		cases.push_back(folded);
+
+		Case popped = { name.str() + " register", Program(), std::vector<Cell>(), 0, true };
+		popped.stack.push_back(Cell(values[i]));
+		popped.program.emit(negate_int32).emit(exit_program);
+		cases.push_back(popped);
+	}
+}
+
+static void stack_cases(std::vector<Case> &cases)
+{
+	const struct { const char *name; Instruction inst; } ops[] = {
+		{ "duplicate", duplicate }, { "drop", drop }, { "swap", swap }, { "over", over }
+	};
+	for (unsigned int o=0; o<sizeof(ops)/sizeof(ops[0]); ++o)
+	{
+		std::string name(ops[o].name);
+
+		Case virtual_values = { name + " constants", Program(), std::vector<Cell>(), 0, true };
+		virtual_values.program.immediate(Cell(4)).immediate(Cell(9)).emit(ops[o].inst).emit(exit_program);
+		cases.push_back(virtual_values);
+
+		Case real_values = { name + " registers", Program(), std::vector<Cell>(), 0, true };
+		real_values.stack.push_back(Cell(4));
+		real_values.stack.push_back(Cell(9));
+		real_values.program.emit(ops[o].inst).emit(add_int32).emit(exit_program);
+		cases.push_back(real_values);
+
+		Case mixed = { name + " float64 below", Program(), std::vector<Cell>(), 0, true };
+		mixed.stack.push_back(Cell(2.5));
+		mixed.program.immediate(Cell(9)).emit(ops[o].inst).emit(exit_program);
+		cases.push_back(mixed);
+
+		Case empty = { name + " empty stack", Program(), std::vector<Cell>(), 0, true };
+		empty.program.emit(ops[o].inst).emit(exit_program);
+		cases.push_back(empty);
+	}
+
+	/* more live values than registers */
+	Case deep = { "deep stack", Program(), std::vector<Cell>(), 0, true };
+	for (int i=1; i<=7; ++i) deep.program.immediate(Cell(i));
+	deep.program.emit(over).emit(over).emit(multiply_int32).emit(add_int32).emit(swap).emit(drop).emit(exit_program);
+	cases.push_back(deep);
+}
+
+/* branch cases */
+
+static void branch_cases(std::vector<Case> &cases)
+{
+	const struct { const char *name; Instruction inst; } kinds[] = { { "jump_if_zero", jump_if_zero }, { "jump_if_nonzero", jump_if_nonzero } };
+	for (unsigned int k=0; k<2; ++k)
+	{
+		for (int condition=0; condition<2; ++condition)
+		{
+			std::stringstream name;
+			name << kinds[k].name << "(" << condition << ")";
+
+			/* forward over a block that leaves a different value */
+			Case constant = { name.str() + " constant", Program(), std::vector<Cell>(), 0, true };
+			Program &p = constant.program;
+			p.immediate(Cell(10)).immediate(Cell(condition));
+			unsigned int skip = p.jump(kinds[k].inst);
+			p.immediate(Cell(5)).emit(add_int32);
+			p.patch(skip, p.here());
+			p.emit(exit_program);
+			cases.push_back(constant);
+
+			/* the condition comes off the real stack */
+			Case popped = { name.str() + " register", Program(), std::vector<Cell>(), 0, true };
+			Program &q = popped.program;
+			popped.stack.push_back(Cell(condition));
+			q.immediate(Cell(10)).emit(swap);
+			skip = q.jump(kinds[k].inst);
+			q.immediate(Cell(5)).emit(add_int32);
+			q.patch(skip, q.here());
+			q.emit(exit_program);
+			cases.push_back(popped);
+		}
+
+		Case mistyped = { std::string(kinds[k].name) + " float64 condition", Program(), std::vector<Cell>(), 0, true };
+		mistyped.stack.push_back(Cell(0.0));
+		unsigned int skip = mistyped.program.jump(kinds[k].inst);
+		mistyped.program.immediate(Cell(1));
+		mistyped.program.patch(skip, mistyped.program.here());
+		mistyped.program.emit(exit_program);
+		cases.push_back(mistyped);
+	}
+
+	/* an unconditional jump over code only reachable by a later jump */
+	Case over_dead = { "jump over dead code", Program(), std::vector<Cell>(), 0, true };
+	{
+		Program &p = over_dead.program;
+		p.immediate(Cell(4));
+		unsigned int skip = p.jump(jump_relative);
+		unsigned int dead = p.here();
+		p.immediate(Cell(100)).emit(add_int32);
+		unsigned int done = p.jump(jump_relative);
+		p.patch(skip, p.here());
+		p.immediate(Cell(1)).emit(add_int32).emit(duplicate).immediate(Cell(5)).emit(less_int32);
+		p.patch(p.jump(jump_if_zero), dead);
+		p.patch(done, p.here());
+		p.emit(exit_program);
+	}
+	cases.push_back(over_dead);
+}
+
+/* i := n; while (i != 0) i := i - 1 */
+static void count_down(Program &p, int n)
+{
+	p.immediate(Cell(n));
+	unsigned int loop = p.here();
+	p.emit(duplicate);
+	unsigned int exit_jump = p.jump(jump_if_zero);
+	p.immediate(Cell(1)).emit(subtract_int32);
+	p.patch(p.jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(exit_program);
+}
+
+/* acc := initial; for i := n downto 1: acc := (acc op i) mod m */
+static void accumulate(Program &p, int initial, int n, Instruction op, int m)
+{
+	p.immediate(Cell(initial)).immediate(Cell(n));
+	unsigned int loop = p.here();
+	p.emit(duplicate);
+	unsigned int exit_jump = p.jump(jump_if_zero);
+	p.emit(swap).emit(over).emit(op).immediate(Cell(m)).emit(modulo_int32);
+	p.emit(swap).immediate(Cell(1)).emit(subtract_int32);
+	p.patch(p.jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(drop).emit(exit_program);
+}
+
+/* counts i in [0, n) with (i * 7) mod 13 < 6, leaving through a backward conditional branch */
+static void branchy_count(Program &p, int n)
+{
+	p.immediate(Cell(0)).immediate(Cell(n));
+	unsigned int loop = p.here();
+	p.emit(duplicate);
+	unsigned int exit_jump = p.jump(jump_if_zero);
+	p.immediate(Cell(1)).emit(subtract_int32).emit(duplicate);
+	p.immediate(Cell(7)).emit(multiply_int32).immediate(Cell(13)).emit(modulo_int32);
+	p.immediate(Cell(6)).emit(less_int32);
+	p.patch(p.jump(jump_if_zero), loop);
+	p.emit(swap).immediate(Cell(1)).emit(add_int32).emit(swap);
+	p.patch(p.jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(drop).emit(exit_program);
+}
+
+/* acc := sum of i for i in [1, n], with an inner loop counting i down to zero each time */
+static void nested_loops(Program &p, int n)
+{
+	p.immediate(Cell(0)).immediate(Cell(n));
+	unsigned int outer = p.here();
+	p.emit(duplicate);
+	unsigned int outer_exit = p.jump(jump_if_zero);
+	p.emit(duplicate);
+	unsigned int inner = p.here();
+	p.emit(duplicate);
+	unsigned int inner_exit = p.jump(jump_if_zero);
+	p.immediate(Cell(1)).emit(subtract_int32);
+	p.patch(p.jump(jump_relative), inner);
+	p.patch(inner_exit, p.here());
+	p.emit(drop).emit(swap).emit(over).emit(add_int32).emit(swap);
+	p.immediate(Cell(1)).emit(subtract_int32);
+	p.patch(p.jump(jump_relative), outer);
+	p.patch(outer_exit, p.here());
+	p.emit(drop).emit(exit_program);
+}
+
+/* a, b, c, d all live across the back-edge, one more than a target keeps in registers */
+static void four_live(Program &p, int n)
+{
+	p.immediate(Cell(1)).immediate(Cell(2)).immediate(Cell(3)).immediate(Cell(n));
+	unsigned int loop = p.here();
+	p.emit(duplicate);
+	unsigned int exit_jump = p.jump(jump_if_zero);
+	p.immediate(Cell(1)).emit(subtract_int32);
+	p.emit(swap).immediate(Cell(2)).emit(add_int32).emit(swap);
+	p.patch(p.jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(exit_program);
+}
+
+/* acc := acc + 1000 / (i - k) for i := n downto 1, so the divisor reaches zero inside native code if 0 < k <= n */
+static void divide_down(Program &p, int n, int k)
+{
+	p.immediate(Cell(n)).immediate(Cell(0));
+	unsigned int loop = p.here();
+	p.emit(over);
+	unsigned int exit_jump = p.jump(jump_if_zero);
+	p.emit(over).immediate(Cell(k)).emit(subtract_int32);
+	p.immediate(Cell(1000)).emit(swap).emit(divide_int32).emit(add_int32);
+	p.emit(swap).immediate(Cell(1)).emit(subtract_int32).emit(swap);
+	p.patch(p.jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(swap).emit(drop).emit(exit_program);
+}
+
+/* acc := acc * 3 until it overflows */
+static void overflow_loop(Program &p)
+{
+	p.immediate(Cell(1));
+	unsigned int loop = p.here();
+	p.immediate(Cell(3)).emit(multiply_int32);
+	p.patch(p.jump(jump_relative), loop);
+	p.emit(exit_program);
+}
+
+/* the loop counter is a float64, so native code hands the first instruction back and the branch throws */
+static void float_counter(Program &p)
+{
+	unsigned int loop = p.here();
+	p.emit(duplicate);
+	unsigned int exit_jump = p.jump(jump_if_zero);
+	p.immediate(Cell(1)).emit(subtract_int32);
+	p.patch(p.jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(exit_program);
+}
+
+/* int32 counting around float64 work, which keeps the loop out of native code */
+static void harmonic_sum(Program &p, int n)
+{
+	p.immediate(Cell(n)).immediate(Cell(0.0));
+	unsigned int loop = p.here();
+	p.emit(over);
+	unsigned int exit_jump = p.jump(jump_if_zero);
+	p.emit(over).emit(convert_to_float64).immediate(Cell(1.0)).emit(swap).emit(divide_float64).emit(add_float64);
+	p.emit(swap).immediate(Cell(1)).emit(subtract_int32).emit(swap);
+	p.patch(p.jump(jump_relative), loop);
+	p.patch(exit_jump, p.here());
+	p.emit(swap).emit(drop).emit(exit_program);
+}
+
+static Case loop_case(const std::string &name, bool native, unsigned long long fuel = 0)
+{
+	Case c = { name, Program(), std::vector<Cell>(), fuel, native };
+	return c;
+}
+
+static void loop_cases(std::vector<Case> &cases)
+{
+	const int counts[] = { 0, 1, 2, 1000 };
+	for (unsigned int i=0; i<sizeof(counts)/sizeof(counts[0]); ++i)
+	{
+		std::stringstream suffix;
+		suffix << "(" << counts[i] << ")";
+
+		Case down = loop_case("count_down" + suffix.str(), true);
+		count_down(down.program, counts[i]);
+		cases.push_back(down);
+
+		Case sum = loop_case("modular_sum" + suffix.str(), true);
+		accumulate(sum.program, 0, counts[i], add_int32, 1000003);
+		cases.push_back(sum);
+
+		Case product = loop_case("modular_product" + suffix.str(), true);
+		accumulate(product.program, 1, counts[i], multiply_int32, 10007);
+		cases.push_back(product);
+
+		Case branchy = loop_case("branchy_count" + suffix.str(), true);
+		branchy_count(branchy.program, counts[i]);
+		cases.push_back(branchy);
+
+		Case nested = loop_case("nested_loops" + suffix.str(), true);
+		nested_loops(nested.program, counts[i] > 100 ? 40 : counts[i]);
+		cases.push_back(nested);
+
+		Case live = loop_case("four_live" + suffix.str(), true);
+		four_live(live.program, counts[i]);
+		cases.push_back(live);
+	}
+
+	Case below = loop_case("count_down over a float64", true);
+	below.stack.push_back(Cell(0.5));
+	count_down(below.program, 50);
+	cases.push_back(below);
+
+	Case by_zero = loop_case("divide by zero in a loop", true);
+	divide_down(by_zero.program, 20, 7);
+	cases.push_back(by_zero);
+
+	Case by_nonzero = loop_case("divide in a loop", true);
+	divide_down(by_nonzero.program, 20, -3);
+	cases.push_back(by_nonzero);
+
+	Case overflow = loop_case("multiply overflows in a loop", true);
+	overflow_loop(overflow.program);
+	cases.push_back(overflow);
+
+	Case mistyped = loop_case("float64 loop counter", true);
+	mistyped.stack.push_back(Cell(3.0));
+	float_counter(mistyped.program);
+	cases.push_back(mistyped);
+
+	Case harmonic = loop_case("harmonic_sum", false);
+	harmonic_sum(harmonic.program, 100);
+	cases.push_back(harmonic);
+
+	/* suspended at back-edges with values in registers, resumed through an entry trampoline */
+	const unsigned long long fuels[] = { 1, 7, 64 };
+	for (unsigned int f=0; f<sizeof(fuels)/sizeof(fuels[0]); ++f)
+	{
+		std::stringstream suffix;
+		suffix << " with fuel " << fuels[f];
+
+		Case down = loop_case("count_down(300)" + suffix.str(), true, fuels[f]);
+		count_down(down.program, 300);
+		cases.push_back(down);
+
+		Case branchy = loop_case("branchy_count(300)" + suffix.str(), true, fuels[f]);
+		branchy_count(branchy.program, 300);
+		cases.push_back(branchy);
+
+		Case nested = loop_case("nested_loops(12)" + suffix.str(), true, fuels[f]);
+		nested_loops(nested.program, 12);
+		cases.push_back(nested);
+
+		Case live = loop_case("four_live(100)" + suffix.str(), true, fuels[f]);
+		four_live(live.program, 100);
+		cases.push_back(live);
+	}
+}
+
+/* generic instructions and constants the JIT calls back into the runtime for */
+static void generic_cases(std::vector<Case> &cases)
+{
+	Case floats = { "float64 arithmetic", Program(), std::vector<Cell>(), 0, true };
+	floats.program.immediate(Cell(2)).immediate(Cell(1.5)).immediate(Cell(2.25)).emit(add_float64);
+	floats.program.emit(swap).immediate(Cell(3)).emit(multiply_int32).emit(exit_program);
+	cases.push_back(floats);
+
+	Case int64s = { "int64 overflow", Program(), std::vector<Cell>(), 0, true };
+	int64s.program.immediate(Cell(7)).immediate(Cell(LLONG_MAX)).immediate(Cell(1LL)).emit(add_int64).emit(exit_program);
+	cases.push_back(int64s);
+
+	Case mistyped = { "float64 add on int32", Program(), std::vector<Cell>(), 0, true };
+	mistyped.program.immediate(Cell(1)).immediate(Cell(2)).emit(add_float64).emit(exit_program);
+	cases.push_back(mistyped);
+}
+
+int main()
+{
+	std::vector<Case> cases;
+	binary_cases(cases);
+	negate_cases(cases);
+	stack_cases(cases);
+	branch_cases(cases);
+	loop_cases(cases);
+	generic_cases(cases);
+
+	unsigned int failures = 0;
+	for (unsigned int i=0; i<cases.size(); ++i)
+	{
+		const Case &c = cases[i];
+		bool entered = false;
+		std::string results[3];
+		for (int mode=CHECKED; mode<=COMPILED; ++mode)
+		{
+			results[mode] = run(c, static_cast<Mode>(mode), &entered);
+		}
+
+		bool agree = results[VERIFIED] == results[CHECKED] && results[COMPILED] == results[CHECKED];
+		if (agree && entered == c.native) continue;
+
+		++failures;
+		std::cout << "FAIL " << c.name << std::endl;
+		for (int mode=CHECKED; mode<=COMPILED; ++mode)
+		{
+			std::cout << "  " << mode_names[mode] << ": " << results[mode] << std::endl;
+		}
+		if (entered != c.native) std::cout << "  native code " << (entered ? "was" : "was not") << " entered" << std::endl;
+	}
+
+	std::cout << cases.size() - failures << "/" << cases.size() << " cases agree" << std::endl;
+	return failures == 0 ? 0 : 1;
+}